@@ -0,0 +1,427 @@
+// Runs the conversion pipeline on deterministic synthetic scRGB images and prints the timings as CSV
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "avif.h"
+#include "pipeline.h"
+#include "pixel_source.h"
+#include "platform.h"
+#include "pool.h"
+#include "trace.h"
+
+#define DEFAULT_SIZES "1080p,4k"
+#define DEFAULT_SPEEDS "10,8,6"
+
+#define PI 3.14159265f
+
+typedef struct BenchSize {
+    const char *name;
+    uint32_t width;
+    uint32_t height;
+} BenchSize;
+
+// Ordered by pixel count, so that where the peak memory can't be reset between runs, it grows with the size
+static const BenchSize sizes[] = {
+        {"1080p",   1920,  1080},
+        {"1440p",   2560,  1440},
+        {"3x1080p", 5760,  1080},
+        {"4k",      3840,  2160},
+        {"3x1440p", 7680,  1440},
+        {"5k",      5120,  2880},
+        {"3x4k",    11520, 2160},
+        {"8k",      7680,  4320},
+};
+#define SIZE_COUNT (sizeof(sizes) / sizeof(sizes[0]))
+
+// Computes the scRGB color of pixel (x, y) of a width x height image
+typedef void (*PatternFunc)(uint32_t x, uint32_t y, uint32_t width, uint32_t height, float rgb[3]);
+
+typedef struct BenchPattern {
+    const char *name;
+    PatternFunc pixel;
+} BenchPattern;
+
+static uint32_t hash(uint32_t x, uint32_t y, uint32_t seed) {
+    uint32_t h = x * 0x8da6b343u ^ y * 0xd8163841u ^ seed * 0xcb1ab31fu;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
+// Uniform in [0, 1)
+static float unit(uint32_t h) {
+    return (float) (h >> 8) * (1.0f / 16777216);
+}
+
+// Smooth ramp of brightness from 1.25 to 10000 nits left to right, sweeping through the hues top to bottom
+static void gradientPixel(uint32_t x, uint32_t y, uint32_t width, uint32_t height, float rgb[3]) {
+    float u = (x + 0.5f) / width;
+    float v = (y + 0.5f) / height;
+    float level = exp2f(-6 + 13 * u);
+
+    for (int k = 0; k < 3; k++) {
+        rgb[k] = level * (0.5f + 0.5f * cosf(2 * PI * (v + k / 3.f)));
+    }
+}
+
+// Low frequency shading with a tint, like the lighting of a 3D scene
+static void shadePixel(uint32_t x, uint32_t y, float scale, float rgb[3]) {
+    float s = 0.6f + 0.25f * sinf(x * 0.0041f + y * 0.0023f) + 0.15f * sinf(x * 0.0173f - y * 0.0097f);
+    rgb[0] = scale * s * (1.1f + 0.3f * sinf(y * 0.0031f));
+    rgb[1] = scale * s;
+    rgb[2] = scale * s * (0.8f + 0.3f * cosf(x * 0.0027f));
+}
+
+// Desktop with windows of flat colors, title bars and rows of text, and now and then an HDR picture in a window
+static void uiPixel(uint32_t x, uint32_t y, uint32_t width, uint32_t height, float rgb[3]) {
+    static const float palette[][3] = {
+            {1.0f,   1.0f,   1.0f},   // light mode
+            {0.93f,  0.93f,  0.93f},
+            {0.12f,  0.12f,  0.13f},  // dark mode
+            {0.2f,   0.2f,   0.22f},
+    };
+    uint32_t cellX = x / 480, cellY = y / 320;
+    uint32_t inX = x % 480, inY = y % 320;
+    uint32_t window = hash(cellX, cellY, 1);
+
+    // Desktop wallpaper between the windows
+    if (inX < 16 || inY < 16 || window % 5 == 0) {
+        shadePixel(x, y, 0.4f, rgb);
+        return;
+    }
+
+    const float *body = palette[window / 5 % 4];
+    float text = body[1] > 0.5f ? 0.05f : 0.9f;
+
+    if (inY < 48) {
+        // Title bar in an accent color, with a caption
+        float accent = 0.3f + 0.5f * unit(window);
+        int caption = inX > 32 && inX < 200 && inY > 24 && inY < 38 && hash(x / 7, y, 2) % 3 != 0;
+        rgb[0] = caption ? 1 : accent * 0.3f;
+        rgb[1] = caption ? 1 : accent * 0.6f;
+        rgb[2] = caption ? 1 : accent;
+    } else if (window % 7 == 3 && inX >= 48 && inX < 432 && inY >= 80 && inY < 288) {
+        // HDR picture
+        gradientPixel(inX - 48, y, 384, height, rgb);
+    } else {
+        // Text lines of words, each one a run of glyphs
+        uint32_t line = (inY - 48) / 18, row = (inY - 48) % 18;
+        uint32_t word = hash(inX / 40, line, window);
+        int glyph = row >= 4 && row < 14 && inX >= 32 && inX < 448 && word % 4 != 0 && inX % 40 < 32 &&
+                    hash(inX / 2, inY, window) % 4 != 0;
+        for (int k = 0; k < 3; k++) {
+            rgb[k] = glyph ? text : body[k];
+        }
+    }
+}
+
+// Game frame: shading with saturated colors beyond sRGB and per-pixel noise, like film grain or dithering
+static void noisePixel(uint32_t x, uint32_t y, uint32_t width, uint32_t height, float rgb[3]) {
+    shadePixel(x, y, 3, rgb);
+
+    uint32_t h = hash(x, y, 3);
+    float grain = 0.8f + 0.4f * unit(h);
+    float saturation = 0.5f + 0.5f * sinf(x * 0.0011f + y * 0.0019f);
+
+    float luma = 0.2126f * rgb[0] + 0.7152f * rgb[1] + 0.0722f * rgb[2];
+    for (int k = 0; k < 3; k++) {
+        // Extrapolating away from grey gives the negative components of wide gamut scRGB
+        float c = luma + (rgb[k] - luma) * (1 + 3 * saturation);
+        rgb[k] = c * grain * (0.95f + 0.1f * unit(hash(x, y, 4 + k)));
+    }
+}
+
+// Dark scene with small highlights up to 10000 nits and a few beyond, like sunlight glinting off metal
+static void specularPixel(uint32_t x, uint32_t y, uint32_t width, uint32_t height, float rgb[3]) {
+    noisePixel(x, y, width, height, rgb);
+    for (int k = 0; k < 3; k++) {
+        rgb[k] *= 0.15f;
+    }
+
+    // At most one highlight per 64x64 cell, so it fits inside it
+    uint32_t cell = hash(x / 64, y / 64, 5);
+    if (cell % 6 != 0) {
+        return;
+    }
+    float cx = 18 + 28 * unit(hash(x / 64, y / 64, 6));
+    float cy = 18 + 28 * unit(hash(x / 64, y / 64, 7));
+    float radius = 2 + 12 * unit(cell);
+    float dx = x % 64 + 0.5f - cx, dy = y % 64 + 0.5f - cy;
+    float d2 = (dx * dx + dy * dy) / (radius * radius);
+    if (d2 >= 1) {
+        return;
+    }
+
+    float peak = cell % 5 == 0 ? 160 : 10 + 115 * unit(hash(x / 64, y / 64, 8));
+    float falloff = (1 - d2) * (1 - d2);
+    for (int k = 0; k < 3; k++) {
+        rgb[k] += peak * falloff;
+    }
+}
+
+static const BenchPattern patterns[] = {
+        {"gradient", gradientPixel},
+        {"ui",       uiPixel},
+        {"noise",    noisePixel},
+        {"specular", specularPixel},
+};
+#define PATTERN_COUNT (sizeof(patterns) / sizeof(patterns[0]))
+
+static const char *const formats[] = {"float", "half"};
+#define FORMAT_COUNT 2
+
+typedef struct GenerateJob {
+    PatternFunc pixel;
+    uint8_t *pixels;
+    uint32_t width;
+    uint32_t height;
+    uint8_t bytesPerColor;
+} GenerateJob;
+
+// Pool task, fills rows [begin, end) of the image
+static void generateRows(void *arg, uint32_t worker, uint32_t begin, uint32_t end) {
+    GenerateJob *job = (GenerateJob *) arg;
+    size_t stride = (size_t) job->width * job->bytesPerColor * 4;
+
+    for (uint32_t y = begin; y < end; y++) {
+        uint8_t *row = job->pixels + stride * y;
+        for (uint32_t x = 0; x < job->width; x++) {
+            float rgb[3];
+            job->pixel(x, y, job->width, job->height, rgb);
+            if (job->bytesPerColor == 4) {
+                float *p = (float *) row + 4 * x;
+                p[0] = rgb[0];
+                p[1] = rgb[1];
+                p[2] = rgb[2];
+                p[3] = 1;
+            } else {
+                _Float16 *p = (_Float16 *) row + 4 * x;
+                p[0] = (_Float16) rgb[0];
+                p[1] = (_Float16) rgb[1];
+                p[2] = (_Float16) rgb[2];
+                p[3] = (_Float16) 1.0f;
+            }
+        }
+    }
+}
+
+// Parses a comma separated list of names, or "all", into a bit mask of their indices. Returns 0 on success.
+static int parseNames(const char *list, const char *what, const char *(*name)(uint32_t), uint32_t count,
+                      uint32_t *mask) {
+    *mask = 0;
+    if (!strcmp("all", list)) {
+        *mask = (1u << count) - 1;
+        return 0;
+    }
+
+    while (*list) {
+        size_t length = strcspn(list, ",");
+        uint32_t i = 0;
+        for (; i < count; i++) {
+            if (strlen(name(i)) == length && !strncmp(name(i), list, length)) {
+                break;
+            }
+        }
+        if (i == count) {
+            fprintf(stderr, "Unknown %s %.*s, must be all or one of:", what, (int) length, list);
+            for (i = 0; i < count; i++) {
+                fprintf(stderr, " %s", name(i));
+            }
+            fprintf(stderr, "\n");
+            return 1;
+        }
+        *mask |= 1u << i;
+        list += length + (list[length] == ',');
+    }
+    return 0;
+}
+
+static const char *sizeName(uint32_t i) {
+    return sizes[i].name;
+}
+
+static const char *patternName(uint32_t i) {
+    return patterns[i].name;
+}
+
+static const char *formatName(uint32_t i) {
+    return formats[i];
+}
+
+// Parses a comma separated list of speeds, or "all", into a bit mask. Returns 0 on success.
+static int parseSpeeds(const char *list, uint32_t *mask) {
+    *mask = 0;
+    if (!strcmp("all", list)) {
+        for (int speed = AVIF_SPEED_SLOWEST; speed <= AVIF_SPEED_FASTEST; speed++) {
+            *mask |= 1u << speed;
+        }
+        return 0;
+    }
+
+    while (*list) {
+        char *end;
+        long speed = strtol(list, &end, 10);
+        if (end == list || (*end != ',' && *end != '\0') || speed < AVIF_SPEED_SLOWEST ||
+            speed > AVIF_SPEED_FASTEST) {
+            fprintf(stderr, "Speeds must be all or in range [%d, %d]\n", AVIF_SPEED_SLOWEST, AVIF_SPEED_FASTEST);
+            return 1;
+        }
+        *mask |= 1u << speed;
+        list = end + (*end == ',');
+    }
+    return 0;
+}
+
+static void printUsage(void) {
+    fprintf(stderr, "jxr_to_avif_bench [--sizes list] [--patterns list] [--formats list] [--speeds list] "
+                    "[--threads n]\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *sizeList = DEFAULT_SIZES;
+    const char *patternList = "all";
+    const char *formatList = "all";
+    const char *speedList = DEFAULT_SPEEDS;
+    uint32_t numThreads = cpuCount();
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp("--sizes", argv[i]) && i + 1 < argc) {
+            sizeList = argv[++i];
+        } else if (!strcmp("--patterns", argv[i]) && i + 1 < argc) {
+            patternList = argv[++i];
+        } else if (!strcmp("--formats", argv[i]) && i + 1 < argc) {
+            formatList = argv[++i];
+        } else if (!strcmp("--speeds", argv[i]) && i + 1 < argc) {
+            speedList = argv[++i];
+        } else if (!strcmp("--threads", argv[i]) && i + 1 < argc) {
+            numThreads = (uint32_t) strtoul(argv[++i], NULL, 10);
+            if (numThreads == 0) {
+                fprintf(stderr, "Threads must be at least 1\n");
+                return 1;
+            }
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    uint32_t sizeMask, patternMask, formatMask, speedMask;
+    if (parseNames(sizeList, "size", sizeName, SIZE_COUNT, &sizeMask) ||
+        parseNames(patternList, "pattern", patternName, PATTERN_COUNT, &patternMask) ||
+        parseNames(formatList, "format", formatName, FORMAT_COUNT, &formatMask) ||
+        parseSpeeds(speedList, &speedMask)) {
+        return 1;
+    }
+
+    ThreadPool *pool = poolCreate(numThreads);
+    if (pool == NULL) {
+        fprintf(stderr, "Failed to create thread pool\n");
+        return 1;
+    }
+
+    ConvertOptions options;
+    convertOptionsInit(&options);
+
+    // Where the peak can't be reset, each run only reports the largest peak of all runs so far
+    int peakPerRun = platformResetPeakMemory() == 0;
+
+    fprintf(stderr, "Using %u threads, %s conversion kernel\n", numThreads, options.kernel->name);
+    printf("size,width,height,pattern,format,speed,convert_s,encode_s,total_s,mpix_per_s,output_bytes,%s,"
+           "decode_cpu_s,linear_cpu_s,pq_cpu_s,yuv_cpu_s,merge_s\n",
+           peakPerRun ? "peak_rss_mb" : "cumulative_peak_rss_mb");
+    fflush(stdout);
+
+    int returnCode = 0;
+
+    for (uint32_t s = 0; s < SIZE_COUNT && returnCode == 0; s++) {
+        if (!(sizeMask & 1u << s)) {
+            continue;
+        }
+        const BenchSize *size = &sizes[s];
+
+        for (uint32_t p = 0; p < PATTERN_COUNT && returnCode == 0; p++) {
+            for (uint32_t f = 0; f < FORMAT_COUNT && returnCode == 0; f++) {
+                if (!(patternMask & 1u << p) || !(formatMask & 1u << f)) {
+                    continue;
+                }
+
+                // The image is generated before any timing starts and shared by the runs at every speed
+                GenerateJob job;
+                job.pixel = patterns[p].pixel;
+                job.width = size->width;
+                job.height = size->height;
+                job.bytesPerColor = f == 0 ? 4 : 2;
+                size_t stride = (size_t) job.width * job.bytesPerColor * 4;
+                job.pixels = malloc(stride * job.height);
+                if (job.pixels == NULL) {
+                    fprintf(stderr, "Failed to allocate %s image\n", size->name);
+                    returnCode = 1;
+                    break;
+                }
+                poolRun(pool, job.height, 16, generateRows, &job);
+
+                for (int speed = AVIF_SPEED_FASTEST; speed >= AVIF_SPEED_SLOWEST; speed--) {
+                    if (!(speedMask & 1u << speed)) {
+                        continue;
+                    }
+                    options.speed = speed;
+                    options.trace = traceCreate(0);
+                    if (options.trace == NULL) {
+                        fprintf(stderr, "Out of memory\n");
+                        returnCode = 1;
+                        break;
+                    }
+                    if (peakPerRun) {
+                        platformResetPeakMemory();
+                    }
+
+                    PixelSource *source = pixelSourceOpenMemory(job.pixels, job.width, job.height,
+                                                                job.bytesPerColor, stride);
+                    avifRWData output = AVIF_DATA_EMPTY;
+                    ConvertResult result;
+                    if (source == NULL || convertSource(&options, source, pool, 0, &output, &result)) {
+                        fprintf(stderr, "Failed to convert %s %s %s image\n", size->name, patterns[p].name,
+                                formats[f]);
+                        traceDestroy(options.trace);
+                        returnCode = 1;
+                        break;
+                    }
+                    double peak = (double) platformPeakMemory() / (1024 * 1024);
+
+                    // The conversion threads run decode, to linear, PQ and YUV side by side, so those only have
+                    // the time the threads spent in them
+                    static const TraceStage stages[] = {TRACE_DECODE, TRACE_LINEAR, TRACE_PQ, TRACE_YUV};
+                    double stageCpu[4];
+                    double wall;
+                    for (int k = 0; k < 4; k++) {
+                        traceTotals(options.trace, stages[k], &wall, &stageCpu[k]);
+                    }
+                    double mergeWall;
+                    double mergeCpu;
+                    traceTotals(options.trace, TRACE_MERGE, &mergeWall, &mergeCpu);
+                    traceDestroy(options.trace);
+                    options.trace = NULL;
+
+                    double total = result.convertSeconds + result.encodeSeconds;
+                    printf("%s,%u,%u,%s,%s,%d,%.3f,%.3f,%.3f,%.2f,%zu,%.1f,%.3f,%.3f,%.3f,%.3f,%.4f\n", size->name,
+                           job.width, job.height, patterns[p].name, formats[f], speed, result.convertSeconds,
+                           result.encodeSeconds, total, (double) job.width * job.height / total / 1e6, output.size,
+                           peak, stageCpu[0], stageCpu[1], stageCpu[2], stageCpu[3], mergeWall);
+                    fflush(stdout);
+                    avifRWDataFree(&output);
+                }
+
+                free(job.pixels);
+            }
+        }
+    }
+
+    poolDestroy(pool);
+    return returnCode;
+}
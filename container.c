@@ -0,0 +1,79 @@
+// Minimal ISOBMFF box walking, just enough to find the item properties of the AVIF files libavif writes
+#include "container.h"
+
+#include <string.h>
+
+static uint32_t readBe32(const uint8_t *p) {
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static void writeBe16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t) (v >> 8);
+    p[1] = (uint8_t) v;
+}
+
+// Finds the next box of the given type in [*pos, end). On success, returns its payload and moves *pos past
+// the box. Returns NULL if there is none or a box header is broken.
+static uint8_t *nextBox(uint8_t **pos, uint8_t *end, const char *type, size_t *payloadSize) {
+    while (end - *pos >= 8) {
+        uint8_t *box = *pos;
+        uint64_t boxSize = readBe32(box);
+        size_t headerSize = 8;
+
+        if (boxSize == 1) {
+            if (end - box < 16) {
+                return NULL;
+            }
+            boxSize = (uint64_t) readBe32(box + 8) << 32 | readBe32(box + 12);
+            headerSize = 16;
+        } else if (boxSize == 0) {
+            boxSize = end - box; // extends to the end of its parent
+        }
+        if (boxSize < headerSize || boxSize > (uint64_t) (end - box)) {
+            return NULL;
+        }
+
+        *pos = box + boxSize;
+        if (!memcmp(box + 4, type, 4)) {
+            *payloadSize = boxSize - headerSize;
+            return box + headerSize;
+        }
+    }
+    return NULL;
+}
+
+uint32_t containerPatchClli(uint8_t *data, size_t size, uint16_t maxCLL, uint16_t maxPALL) {
+    uint8_t *pos = data;
+    size_t metaSize;
+    uint8_t *meta = nextBox(&pos, data + size, "meta", &metaSize);
+    if (meta == NULL || metaSize < 4) {
+        return 0;
+    }
+
+    pos = meta + 4; // FullBox version and flags
+    size_t iprpSize;
+    uint8_t *iprp = nextBox(&pos, meta + metaSize, "iprp", &iprpSize);
+    if (iprp == NULL) {
+        return 0;
+    }
+
+    pos = iprp;
+    size_t ipcoSize;
+    uint8_t *ipco = nextBox(&pos, iprp + iprpSize, "ipco", &ipcoSize);
+    if (ipco == NULL) {
+        return 0;
+    }
+
+    uint32_t patched = 0;
+    uint8_t *clli;
+    size_t clliSize;
+    pos = ipco;
+    while ((clli = nextBox(&pos, ipco + ipcoSize, "clli", &clliSize)) != NULL) {
+        if (clliSize >= 4) {
+            writeBe16(clli, maxCLL);
+            writeBe16(clli + 2, maxPALL);
+            patched++;
+        }
+    }
+    return patched;
+}
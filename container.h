@@ -0,0 +1,12 @@
+#ifndef JXR_TO_AVIF_CONTAINER_H
+#define JXR_TO_AVIF_CONTAINER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Overwrites the values of every 'clli' item property (meta/iprp/ipco/clli) in an encoded AVIF file. The
+// boxes have a fixed size, so an encode with placeholder values can be finished before the real ones are
+// known. Returns the number of boxes patched, 0 if there are none or the file is malformed.
+uint32_t containerPatchClli(uint8_t *data, size_t size, uint16_t maxCLL, uint16_t maxPALL);
+
+#endif // JXR_TO_AVIF_CONTAINER_H
@@ -0,0 +1,452 @@
+#include "convert.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "platform.h"
+
+static const float m1 = 1305 / 8192.f;
+static const float m2 = 2523 / 32.f;
+static const float c1 = 107 / 128.f;
+static const float c3 = 2392 / 128.f;
+
+// The ratio (c1 + c2 * ym1) / (1 + c3 * ym1) is written as 1 - d, and raised to m2 through log1pf: raising the
+// rounded ratio to m2 = 78.8 would amplify its rounding error to over a 16-bit code value
+float pq_inv_eotf(float y) {
+    float ym1 = powf(y, m1);
+    float d = (1 - c1) * (1 - ym1) / (1 + c3 * ym1);
+    return expf(m2 * log1pf(-d));
+}
+
+const float scrgb_to_bt2100[3][3] = {
+        {2939026994.L / 585553224375.L, 9255011753.L / 3513319346250.L, 173911579.L / 501902763750.L},
+        {76515593.L / 138420033750.L,   6109575001.L / 830520202500.L,  75493061.L / 830520202500.L},
+        {12225392.L / 93230009375.L,    1772384008.L / 2517210253125.L, 18035212433.L / 2517210253125.L},
+};
+
+static void matrixVectorMult(const float in[3], float out[3], const float matrix[3][3]) {
+    for (int i = 0; i < 3; i++) {
+        float res = 0;
+        for (int j = 0; j < 3; j++) {
+            res += matrix[i][j] * in[j];
+        }
+        out[i] = res;
+    }
+}
+
+static float saturate(float x) {
+    return min(1, max(x, 0));
+}
+
+static void storeLinear(const float in[3], uint32_t i, ConvertBlock *block) {
+    float bt2020[3];
+    matrixVectorMult(in, bt2020, scrgb_to_bt2100);
+
+    for (int k = 0; k < 3; k++) {
+        bt2020[k] = saturate(bt2020[k]);
+    }
+
+    block->r[i] = bt2020[0];
+    block->g[i] = bt2020[1];
+    block->b[i] = bt2020[2];
+    block->maxComp[i] = max(bt2020[0], max(bt2020[1], bt2020[2]));
+}
+
+void convertToLinearFloatScalar(const float *src, uint32_t start, uint32_t n, ConvertBlock *block) {
+    for (uint32_t i = start; i < n; i++) {
+        storeLinear(src + 4 * i, i, block);
+    }
+}
+
+// Without F16C, a cast from _Float16 is a library call per value. This only takes integer operations and
+// selects, so the compiler can vectorize it. Subnormals go through an integer to float conversion, as the
+// denormals-are-zero mode that -ffast-math enables would flush them if they were built from bits.
+void convertHalfToFloat(const _Float16 *src, float *dst, uint32_t n) {
+    const uint16_t *halves = (const uint16_t *) src;
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t h = halves[i];
+        uint32_t magnitude = h & 0x7fff;
+
+        uint32_t bits = (magnitude << 13) + ((127 - 15) << 23);
+        bits += magnitude >= 0x7c00 ? (128 - 16) << 23 : 0; // infinity and NaN keep the maximum exponent
+        float subnormal = (float) magnitude * (1.f / (1 << 24));
+        if (magnitude < 0x0400) {
+            memcpy(&bits, &subnormal, sizeof(bits));
+        }
+        bits |= (h & 0x8000) << 16;
+
+        memcpy(&dst[i], &bits, sizeof(bits));
+    }
+}
+
+void convertToLinearHalfScalar(const _Float16 *src, uint32_t start, uint32_t n, ConvertBlock *block) {
+    float pixels[4 * 64];
+
+    for (uint32_t i = start; i < n; i += 64) {
+        uint32_t count = min(64, n - i);
+        convertHalfToFloat(src + 4 * i, pixels, 4 * count);
+        for (uint32_t k = 0; k < count; k++) {
+            storeLinear(pixels + 4 * k, i + k, block);
+        }
+    }
+}
+
+// Contribution of every half value of each scRGB component to the linear BT.2100 r, g and b, padded to 16 bytes
+static float halfLut[3][1 << 16][4];
+
+static Once halfLutOnce = ONCE_INIT;
+
+static void buildHalfLut(void) {
+    for (uint32_t h = 0; h < 1 << 16; h++) {
+        uint16_t bits = (uint16_t) h;
+        _Float16 half;
+        float value;
+        memcpy(&half, &bits, sizeof(half));
+        convertHalfToFloat(&half, &value, 1);
+
+        for (int c = 0; c < 3; c++) {
+            for (int k = 0; k < 3; k++) {
+                halfLut[c][h][k] = scrgb_to_bt2100[k][c] * value;
+            }
+        }
+    }
+}
+
+void convertHalfLutInit(void) {
+    onceRun(&halfLutOnce, buildHalfLut);
+}
+
+void convertToLinearHalfLut(const _Float16 *src, uint32_t start, uint32_t n, ConvertBlock *block) {
+    const uint16_t *halves = (const uint16_t *) src;
+
+    for (uint32_t i = start; i < n; i++) {
+        const float *r = halfLut[0][halves[4 * i]];
+        const float *g = halfLut[1][halves[4 * i + 1]];
+        const float *b = halfLut[2][halves[4 * i + 2]];
+
+        float out[3];
+        for (int k = 0; k < 3; k++) {
+            out[k] = saturate(r[k] + g[k] + b[k]);
+        }
+
+        block->r[i] = out[0];
+        block->g[i] = out[1];
+        block->b[i] = out[2];
+        block->maxComp[i] = max(out[0], max(out[1], out[2]));
+    }
+}
+
+void convertPqScalar(float *v, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        v[i] = pq_inv_eotf(v[i]);
+    }
+}
+
+float pqLut[PQ_LUT_SIZE];
+
+static Once pqLutOnce = ONCE_INIT;
+
+// PQ inverse EOTF in double precision, the reference of the table
+static double pqInvEotfDouble(double y) {
+    static const double dm1 = 1305 / 8192.;
+    static const double dm2 = 2523 / 32.;
+    static const double dc1 = 107 / 128.;
+    static const double dc2 = 2413 / 128.;
+    static const double dc3 = 2392 / 128.;
+
+    double ym1 = pow(y, dm1);
+    return pow((dc1 + dc2 * ym1) / (1 + dc3 * ym1), dm2);
+}
+
+static void buildPqLut(void) {
+    for (uint32_t i = 0; i < PQ_LUT_SIZE; i++) {
+        uint32_t bits = 0x00800000 + (i << PQ_LUT_SHIFT);
+        float y;
+        memcpy(&y, &bits, sizeof(y));
+        pqLut[i] = (float) pqInvEotfDouble(y);
+    }
+}
+
+void convertPqLutInit(void) {
+    onceRun(&pqLutOnce, buildPqLut);
+}
+
+void convertPqLutScalar(float *v, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        float y = min(1, max(v[i], FLT_MIN));
+        uint32_t bits;
+        memcpy(&bits, &y, sizeof(bits));
+        uint32_t idx = (bits - 0x00800000) >> PQ_LUT_SHIFT;
+        float weight = (float) (bits & ((1 << PQ_LUT_SHIFT) - 1)) * (1.f / (1 << PQ_LUT_SHIFT));
+        v[i] = pqLut[idx] + weight * (pqLut[idx + 1] - pqLut[idx]);
+    }
+}
+
+const ConvertKernel convertKernelScalar = {
+        "scalar",
+        convertToLinearFloatScalar,
+        convertToLinearHalfScalar,
+        convertPqScalar,
+        convertPqLutScalar,
+};
+
+void (*convertPqFunc(const ConvertKernel *kernel, PqMode mode))(float *v, uint32_t n) {
+    switch (mode) {
+        case PQ_MODE_EXACT:
+            return convertPqScalar;
+        case PQ_MODE_LUT:
+            convertPqLutInit();
+            return kernel->pqLut;
+        default:
+            return kernel->pq;
+    }
+}
+
+static uint16_t quantize(float x, float maxChannel, float bias) {
+    return (uint16_t) min(maxChannel, max(roundf(x * maxChannel + bias), 0));
+}
+
+void convertStoreYuv(const ConvertBlock *block, uint32_t n, uint32_t depth, uint16_t *y, uint16_t *u, uint16_t *v) {
+    const float kr = 0.2627f;
+    const float kb = 0.0593f;
+    const float kg = 1 - kr - kb;
+    const float maxChannel = (float) ((1 << depth) - 1);
+    const float half = (float) (1 << (depth - 1));
+
+    for (uint32_t i = 0; i < n; i++) {
+        float luma = kr * block->r[i] + kg * block->g[i] + kb * block->b[i];
+        float cb = (block->b[i] - luma) / (2 * (1 - kb));
+        float cr = (block->r[i] - luma) / (2 * (1 - kr));
+
+        y[i] = quantize(luma, maxChannel, 0);
+        u[i] = quantize(cb, maxChannel, half);
+        v[i] = quantize(cr, maxChannel, half);
+    }
+}
+
+void convertStoreGbr(const ConvertBlock *block, uint32_t n, uint32_t depth, uint16_t *y, uint16_t *u, uint16_t *v) {
+    const float maxChannel = (float) ((1 << depth) - 1);
+
+    for (uint32_t i = 0; i < n; i++) {
+        y[i] = quantize(block->g[i], maxChannel, 0);
+        u[i] = quantize(block->b[i], maxChannel, 0);
+        v[i] = quantize(block->r[i], maxChannel, 0);
+    }
+}
+
+const ConvertKernel *const convertKernels[] = {
+#if defined(__x86_64__) || defined(_M_X64)
+        &convertKernelAvx512,
+        &convertKernelAvx2,
+        &convertKernelSse41,
+#endif
+#if defined(__aarch64__)
+        &convertKernelNeon,
+#endif
+        &convertKernelScalar,
+        NULL,
+};
+
+int convertKernelSupported(const ConvertKernel *kernel) {
+#if defined(__x86_64__) || defined(_M_X64)
+    __builtin_cpu_init();
+    if (kernel == &convertKernelAvx512) {
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+               __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c");
+    }
+    if (kernel == &convertKernelAvx2) {
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c");
+    }
+    if (kernel == &convertKernelSse41) {
+        return __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("f16c");
+    }
+#endif
+    return 1; // NEON is part of AArch64
+}
+
+const ConvertKernel *convertKernelBest(void) {
+    for (const ConvertKernel *const *kernel = convertKernels; *kernel; kernel++) {
+        if (convertKernelSupported(*kernel)) {
+            return *kernel;
+        }
+    }
+    return &convertKernelScalar;
+}
+
+const ConvertKernel *convertKernelByName(const char *name) {
+    for (const ConvertKernel *const *kernel = convertKernels; *kernel; kernel++) {
+        if (!strcmp((*kernel)->name, name)) {
+            return *kernel;
+        }
+    }
+    return NULL;
+}
+
+// Deterministic test pixels: scRGB values from slightly negative to beyond 10000 nits (125.0), plus the edge
+// cases of the conversion
+static void selfTestPixels(float *pixels, uint32_t count) {
+    static const float special[] = {0, 1, 125, 126, -0.5f, 1e-7f, 6e-8f, 65504, 0.5f, 80};
+    uint32_t state = 0x12345678;
+
+    for (uint32_t i = 0; i < 4 * count; i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        float x = (float) (state >> 8) / (1 << 24);
+        pixels[i] = i < sizeof(special) / sizeof(special[0]) ? special[i] : (state & 1 ? x * x * 130 : x - 0.25f);
+    }
+}
+
+static float maxDifference(const float *a, const float *b, uint32_t n) {
+    float result = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        result = max(result, fabsf(a[i] - b[i]));
+    }
+    return result;
+}
+
+int convertSelfTest(const ConvertKernel *kernel) {
+    // The conversion to linear rounds exactly like the scalar kernel. The SIMD PQ is a polynomial approximation,
+    // within 0.02 16-bit code values of the scalar one over all of [0, 1].
+    const float linearTolerance = 0;
+    const float pqTolerance = 0.05f / 65535;
+    // Table lookups interpolate with or without FMA
+    const float pqLutTolerance = FLT_EPSILON;
+
+    static float pixels[4 * CONVERT_BLOCK];
+    static _Float16 halfPixels[4 * CONVERT_BLOCK];
+    selfTestPixels(pixels, CONVERT_BLOCK);
+    for (uint32_t i = 0; i < 4 * CONVERT_BLOCK; i++) {
+        halfPixels[i] = (_Float16) pixels[i];
+    }
+    convertPqLutInit();
+
+    float linearError = 0;
+    float pqError = 0;
+    float pqLutError = 0;
+
+    // A full block and one that ends in the scalar tail of every kernel
+    for (uint32_t n = CONVERT_BLOCK - 3; n <= CONVERT_BLOCK; n += 3) {
+        for (int half = 0; half < 2; half++) {
+            ConvertBlock expected;
+            ConvertBlock actual;
+            if (half) {
+                convertToLinearHalfScalar(halfPixels, 0, n, &expected);
+                kernel->toLinearHalf(halfPixels, 0, n, &actual);
+            } else {
+                convertToLinearFloatScalar(pixels, 0, n, &expected);
+                kernel->toLinearFloat(pixels, 0, n, &actual);
+            }
+            linearError = max(linearError, maxDifference(expected.r, actual.r, n));
+            linearError = max(linearError, maxDifference(expected.g, actual.g, n));
+            linearError = max(linearError, maxDifference(expected.b, actual.b, n));
+            linearError = max(linearError, maxDifference(expected.maxComp, actual.maxComp, n));
+
+            // Both start from the reference's linear values
+            float reference[CONVERT_BLOCK];
+            float values[CONVERT_BLOCK];
+            memcpy(reference, expected.r, sizeof(reference));
+            memcpy(values, expected.r, sizeof(values));
+            convertPqScalar(reference, n);
+            kernel->pq(values, n);
+            pqError = max(pqError, maxDifference(reference, values, n));
+
+            memcpy(reference, expected.g, sizeof(reference));
+            memcpy(values, expected.g, sizeof(values));
+            convertPqLutScalar(reference, n);
+            kernel->pqLut(values, n);
+            pqLutError = max(pqLutError, maxDifference(reference, values, n));
+        }
+    }
+
+    int failed = linearError > linearTolerance || pqError > pqTolerance || pqLutError > pqLutTolerance;
+    printf("%s: linear %.2g, pq %.2g, pq lut %.2g: %s\n", kernel->name, linearError, pqError, pqLutError,
+           failed ? "FAILED" : "ok");
+    return failed;
+}
+
+int convertHalfLutSelfTest(void) {
+    static _Float16 halfPixels[4 * CONVERT_BLOCK];
+    uint32_t mismatches = 0;
+    uint32_t count = 0;
+    convertHalfLutInit();
+
+    // Every half value in each component on its own, then every value next to the test pixels of the other two
+    for (int mixed = 0; mixed < 2; mixed++) {
+        if (mixed) {
+            static float pixels[4 * CONVERT_BLOCK];
+            selfTestPixels(pixels, CONVERT_BLOCK);
+            for (uint32_t i = 0; i < 4 * CONVERT_BLOCK; i++) {
+                halfPixels[i] = (_Float16) pixels[i];
+            }
+        } else {
+            memset(halfPixels, 0, sizeof(halfPixels));
+        }
+
+        for (int c = 0; c < 3; c++) {
+            for (uint32_t h = 0; h < 1 << 16; h += CONVERT_BLOCK) {
+                for (uint32_t i = 0; i < CONVERT_BLOCK; i++) {
+                    // Infinity and NaN have no defined result, and -ffast-math assumes they don't occur
+                    uint16_t bits = (uint16_t) (h + i);
+                    if ((bits & 0x7c00) == 0x7c00) {
+                        bits = 0;
+                    }
+                    memcpy(&halfPixels[4 * i + c], &bits, sizeof(bits));
+                }
+
+                ConvertBlock expected;
+                ConvertBlock actual;
+                convertToLinearHalfScalar(halfPixels, 0, CONVERT_BLOCK, &expected);
+                convertToLinearHalfLut(halfPixels, 0, CONVERT_BLOCK, &actual);
+                for (uint32_t i = 0; i < CONVERT_BLOCK; i++) {
+                    mismatches += expected.r[i] != actual.r[i] || expected.g[i] != actual.g[i] ||
+                                  expected.b[i] != actual.b[i] || expected.maxComp[i] != actual.maxComp[i];
+                }
+                count += CONVERT_BLOCK;
+            }
+        }
+    }
+
+    printf("half lut: %u of %u pixels differ from scalar: %s\n", mismatches, count, mismatches ? "FAILED" : "ok");
+    return mismatches != 0;
+}
+
+int convertPqLutSelfTest(void) {
+    // The bound documented in convert.h, in 16-bit code values
+    const double tolerance = 0.22;
+    // Every 61st float from 0 to 1: a prime step, so the samples fall on every position between table points
+    const uint32_t step = 61;
+    const uint32_t oneBits = 0x3f800000;
+
+    float values[CONVERT_BLOCK];
+    float inputs[CONVERT_BLOCK];
+    double maxError = 0;
+    uint32_t count = 0;
+    convertPqLutInit();
+
+    for (uint32_t bits = 0; bits <= oneBits;) {
+        uint32_t n = 0;
+        for (; n < CONVERT_BLOCK && bits <= oneBits; n++) {
+            memcpy(&inputs[n], &bits, sizeof(bits));
+            // Ends exactly on 1, the top of the table
+            bits = bits < oneBits && oneBits - bits < step ? oneBits : bits + step;
+        }
+        memcpy(values, inputs, sizeof(values));
+        convertPqLutScalar(values, n);
+
+        for (uint32_t i = 0; i < n; i++) {
+            // Inputs below FLT_MIN are looked up as FLT_MIN, which is the same to well within the tolerance
+            double error = fabs(values[i] - pqInvEotfDouble(inputs[i])) * 65535;
+            maxError = error > maxError ? error : maxError;
+        }
+        count += n;
+    }
+
+    int failed = maxError > tolerance;
+    printf("pq lut: max %.3f 16-bit code values off over %u values in [0, 1]: %s\n", maxError, count,
+           failed ? "FAILED" : "ok");
+    return failed;
+}
@@ -0,0 +1,120 @@
+#ifndef JXR_TO_AVIF_CONVERT_H
+#define JXR_TO_AVIF_CONVERT_H
+
+#include <stdint.h>
+
+#define CONVERT_BLOCK 256  // pixels per kernel call, small enough for the planar block to stay in L1
+
+// Planar scratch space for one block of pixels. After toLinear*, r/g/b hold saturated linear BT.2100
+// values (1.0 = 10000 nits) and maxComp holds max(r, g, b) for each pixel. After pq, r/g/b hold the
+// nonlinear PQ values in [0, 1].
+typedef struct ConvertBlock {
+    _Alignas(64) float r[CONVERT_BLOCK];
+    _Alignas(64) float g[CONVERT_BLOCK];
+    _Alignas(64) float b[CONVERT_BLOCK];
+    _Alignas(64) float maxComp[CONVERT_BLOCK];
+} ConvertBlock;
+
+typedef struct ConvertKernel {
+    const char *name;
+    // Converts pixels [start, n) of a block of RGBA scRGB pixels. src points at the first pixel of the block.
+    // Every kernel gives exactly the result of the scalar one.
+    void (*toLinearFloat)(const float *src, uint32_t start, uint32_t n, ConvertBlock *block);
+    void (*toLinearHalf)(const _Float16 *src, uint32_t start, uint32_t n, ConvertBlock *block);
+    // Applies the PQ inverse EOTF to n values in place. Over all floats in [0, 1], every kernel is within 0.02
+    // 16-bit code values of a double precision reference.
+    void (*pq)(float *v, uint32_t n);
+    // Same as pq, but interpolated from pqLut, see below
+    void (*pqLut)(float *v, uint32_t n);
+} ConvertKernel;
+
+// PQ inverse EOTF sampled at 2^PQ_LUT_BITS evenly spaced points per octave of the input, from FLT_MIN to 1,
+// for linear interpolation. Index and weight come straight from the float's bits: the index is
+// (bits - bits(FLT_MIN)) >> PQ_LUT_SHIFT, the weight is the remaining low mantissa bits. Compared with a
+// double precision reference over every float in [0, 1], the interpolated value is off by at most 0.22
+// code values at 16 bits (0.014 at 12 bits), so after rounding the output differs from the exact curve
+// by at most one 16-bit code value. convertPqLutInit() must be called before the first lookup.
+#define PQ_LUT_BITS 6
+#define PQ_LUT_SHIFT (23 - PQ_LUT_BITS)
+#define PQ_LUT_SIZE ((126 << PQ_LUT_BITS) + 2)
+extern float pqLut[PQ_LUT_SIZE];
+void convertPqLutInit(void);
+
+// Half float input can be converted by table lookup instead: every one of the 65536 values of each scRGB
+// component has its contributions to r, g and b precomputed (3 MB in total), so a pixel takes three
+// lookups and additions, without any half to float conversion or multiplication. For finite input the result
+// is bit for bit that of the scalar kernel, as convert.c is built without reassociation or contraction into FMA.
+// convertHalfLutInit() must be called before the first conversion, and can be called from any thread.
+void convertHalfLutInit(void);
+void convertToLinearHalfLut(const _Float16 *src, uint32_t start, uint32_t n, ConvertBlock *block);
+
+typedef enum PqMode {
+    PQ_MODE_AUTO = 0, // the kernel's own PQ: vectorized exp2/log2 for SIMD kernels, pq_inv_eotf() for the scalar one
+    PQ_MODE_EXACT,    // pq_inv_eotf(), one pixel at a time
+    PQ_MODE_LUT,      // table lookup with linear interpolation
+} PqMode;
+
+// Returns the PQ function of the kernel for the given mode. Initializes the table if needed.
+void (*convertPqFunc(const ConvertKernel *kernel, PqMode mode))(float *v, uint32_t n);
+
+extern const float scrgb_to_bt2100[3][3];
+
+extern const ConvertKernel convertKernelScalar;
+#if defined(__x86_64__) || defined(_M_X64)
+extern const ConvertKernel convertKernelSse41;
+extern const ConvertKernel convertKernelAvx2;
+extern const ConvertKernel convertKernelAvx512;
+#endif
+#if defined(__aarch64__)
+extern const ConvertKernel convertKernelNeon;
+#endif
+
+// Every kernel built for this architecture, fastest first, NULL terminated
+extern const ConvertKernel *const convertKernels[];
+
+// Returns 1 if the CPU has the instruction sets the kernel needs
+int convertKernelSupported(const ConvertKernel *kernel);
+
+// Returns the fastest kernel the CPU supports
+const ConvertKernel *convertKernelBest(void);
+
+// Returns the kernel with the given name, or NULL if there is none. Does not check for CPU support.
+const ConvertKernel *convertKernelByName(const char *name);
+
+// Checks the kernel against the scalar one on a fixed set of pixels, covering the SIMD loops, their scalar
+// tails and edge cases like negative and out of range input. Prints one line with the largest differences
+// found. Returns 0 if they are within tolerance.
+int convertSelfTest(const ConvertKernel *kernel);
+
+// Checks that the half float table gives exactly the result of the scalar kernel for every finite half value of
+// each component. Prints one line with the number of pixels that differ. Returns 0 if there are none.
+int convertHalfLutSelfTest(void);
+
+// Checks the scalar PQ table lookup against a double precision reference on a dense sample of the floats in
+// [0, 1], and fails if the error exceeds the bound documented for the table. Prints one line with the largest
+// error found. Returns 0 if it is within the bound.
+int convertPqLutSelfTest(void);
+
+// PQ inverse EOTF through powf, expf and log1pf, within 0.015 16-bit code values of a double precision reference
+float pq_inv_eotf(float y);
+
+void convertToLinearFloatScalar(const float *src, uint32_t start, uint32_t n, ConvertBlock *block);
+void convertToLinearHalfScalar(const _Float16 *src, uint32_t start, uint32_t n, ConvertBlock *block);
+// Converts n half floats to floats, exactly, without needing F16C
+void convertHalfToFloat(const _Float16 *src, float *dst, uint32_t n);
+void convertPqScalar(float *v, uint32_t n);
+void convertPqLutScalar(float *v, uint32_t n);
+
+// Quantize the PQ values of a block to full range planes of the given bit depth, rounding once. The YUV
+// variant uses the BT.2020 NCL coefficients with the same formulas as avifImageRGBToYUV, the GBR variant
+// is for the identity matrix.
+void convertStoreYuv(const ConvertBlock *block, uint32_t n, uint32_t depth, uint16_t *y, uint16_t *u, uint16_t *v);
+void convertStoreGbr(const ConvertBlock *block, uint32_t n, uint32_t depth, uint16_t *y, uint16_t *u, uint16_t *v);
+
+// Same, but bit-exact with rounding to 16-bit RGB first and converting that with avifImageRGBToYUV()
+void convertStoreYuvLibavif(const ConvertBlock *block, uint32_t n, uint32_t depth, uint16_t *y, uint16_t *u,
+                            uint16_t *v);
+void convertStoreGbrLibavif(const ConvertBlock *block, uint32_t n, uint32_t depth, uint16_t *y, uint16_t *u,
+                            uint16_t *v);
+
+#endif // JXR_TO_AVIF_CONVERT_H
@@ -0,0 +1,164 @@
+// AVX2 + FMA + F16C conversion kernel, 8 pixels per iteration. Built with -mavx2 -mfma -mf16c and only
+// selected at runtime if the CPU supports it.
+#include "convert.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+#include <float.h>
+#include <immintrin.h>
+
+// log2((1 + t) / (1 - t)) from the series of atanh, 2 / ln(2) * (t + t^3 / 3 + ...). Five terms are
+// accurate to float precision for |t| < 0.172.
+static inline __m256 log2SeriesAvx2(__m256 t) {
+    __m256 t2 = _mm256_mul_ps(t, t);
+    __m256 p = _mm256_set1_ps(0.32059889f);                      // 2 / (9 ln 2)
+    p = _mm256_fmadd_ps(p, t2, _mm256_set1_ps(0.41219858f));     // 2 / (7 ln 2)
+    p = _mm256_fmadd_ps(p, t2, _mm256_set1_ps(0.57707802f));     // 2 / (5 ln 2)
+    p = _mm256_fmadd_ps(p, t2, _mm256_set1_ps(0.96179669f));     // 2 / (3 ln 2)
+    p = _mm256_fmadd_ps(p, t2, _mm256_set1_ps(2.88539008f));     // 2 / ln 2
+    return _mm256_mul_ps(p, t);
+}
+
+// log2 for x > 0: split off the exponent, then the series above for the mantissa m in
+// [sqrt(0.5), sqrt(2)) with t = (m - 1) / (m + 1)
+static inline __m256 log2Avx2(__m256 x) {
+    __m256i xi = _mm256_castps_si256(x);
+    __m256i e = _mm256_sub_epi32(_mm256_srli_epi32(xi, 23), _mm256_set1_epi32(127));
+    __m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(xi, _mm256_set1_epi32(0x7fffff)),
+                                                   _mm256_set1_epi32(0x3f800000)));
+
+    __m256 big = _mm256_cmp_ps(m, _mm256_set1_ps(1.41421356f), _CMP_GT_OQ);
+    m = _mm256_blendv_ps(m, _mm256_mul_ps(m, _mm256_set1_ps(0.5f)), big);
+    e = _mm256_sub_epi32(e, _mm256_castps_si256(big)); // big is all ones, i.e. -1
+
+    __m256 t = _mm256_div_ps(_mm256_sub_ps(m, _mm256_set1_ps(1)), _mm256_add_ps(m, _mm256_set1_ps(1)));
+    return _mm256_add_ps(log2SeriesAvx2(t), _mm256_cvtepi32_ps(e));
+}
+
+// exp2 for -126 <= x <= 0: 2^round(x) from the exponent bits times a degree 7 Taylor polynomial of
+// 2^f for f in [-0.5, 0.5]
+static inline __m256 exp2Avx2(__m256 x) {
+    x = _mm256_max_ps(x, _mm256_set1_ps(-126));
+    __m256 n = _mm256_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 f = _mm256_sub_ps(x, n);
+
+    __m256 p = _mm256_set1_ps(1.5252734e-5f);
+    p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(1.5403530e-4f));
+    p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(1.3333558e-3f));
+    p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(9.6181291e-3f));
+    p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(5.5504109e-2f));
+    p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(2.4022651e-1f));
+    p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(6.9314718e-1f));
+    p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(1));
+
+    __m256i scale = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(scale));
+}
+
+static inline __m256 pqAvx2(__m256 y) {
+    const __m256 m1 = _mm256_set1_ps(1305 / 8192.f);
+    const __m256 m2 = _mm256_set1_ps(2523 / 32.f);
+    const __m256 c3 = _mm256_set1_ps(2392 / 128.f);
+    const __m256 one = _mm256_set1_ps(1);
+
+    __m256 ym1 = exp2Avx2(_mm256_mul_ps(m1, log2Avx2(_mm256_max_ps(y, _mm256_set1_ps(FLT_MIN)))));
+
+    // The ratio (c1 + c2 * ym1) / (1 + c3 * ym1) lies in [c1, 1] and gets raised to the power of m2 = 78.84,
+    // which amplifies its rounding error. Since 1 - c1 = c2 - c3 = 21 / 128, the ratio is 1 - d with
+    // d = 21 / 128 * (1 - ym1) / (1 + c3 * ym1), and log2(1 - d) = log2Series(-d / (2 - d)) needs no
+    // rounded ratio at all.
+    __m256 d = _mm256_div_ps(_mm256_mul_ps(_mm256_set1_ps(21 / 128.f), _mm256_sub_ps(one, ym1)),
+                             _mm256_fmadd_ps(c3, ym1, one));
+    __m256 t = _mm256_div_ps(d, _mm256_sub_ps(d, _mm256_set1_ps(2)));
+    return exp2Avx2(_mm256_mul_ps(m2, log2SeriesAvx2(t)));
+}
+
+// p04 holds pixels 0 and 4 (one per 128-bit lane), p15 pixels 1 and 5, and so on
+static inline void storeLinearAvx2(__m256 p04, __m256 p15, __m256 p26, __m256 p37, uint32_t i, ConvertBlock *block) {
+    __m256 t0 = _mm256_unpacklo_ps(p04, p15); // r0 r1 g0 g1 | r4 r5 g4 g5
+    __m256 t1 = _mm256_unpackhi_ps(p04, p15); // b0 b1 a0 a1 | b4 b5 a4 a5
+    __m256 t2 = _mm256_unpacklo_ps(p26, p37); // r2 r3 g2 g3 | r6 r7 g6 g7
+    __m256 t3 = _mm256_unpackhi_ps(p26, p37); // b2 b3 a2 a3 | b6 b7 a6 a7
+    __m256 in[3] = {
+            _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0)),
+            _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2)),
+            _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0)),
+    };
+
+    // Without FMA and in the scalar kernel's order: near black, a fused rounding would move the PQ output by over
+    // a 16-bit code value when the components cancel out
+    __m256 out[3];
+    for (int k = 0; k < 3; k++) {
+        __m256 res = _mm256_mul_ps(_mm256_set1_ps(scrgb_to_bt2100[k][0]), in[0]);
+        res = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(scrgb_to_bt2100[k][1]), in[1]), res);
+        res = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(scrgb_to_bt2100[k][2]), in[2]), res);
+        out[k] = _mm256_min_ps(_mm256_set1_ps(1), _mm256_max_ps(res, _mm256_setzero_ps()));
+    }
+
+    _mm256_storeu_ps(block->r + i, out[0]);
+    _mm256_storeu_ps(block->g + i, out[1]);
+    _mm256_storeu_ps(block->b + i, out[2]);
+    _mm256_storeu_ps(block->maxComp + i, _mm256_max_ps(out[0], _mm256_max_ps(out[1], out[2])));
+}
+
+static void toLinearFloatAvx2(const float *src, uint32_t start, uint32_t n, ConvertBlock *block) {
+    uint32_t i = start;
+    for (; i + 8 <= n; i += 8) {
+        const float *p = src + 4 * i;
+        __m256 p04 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p + 0)), _mm_loadu_ps(p + 16), 1);
+        __m256 p15 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p + 4)), _mm_loadu_ps(p + 20), 1);
+        __m256 p26 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p + 8)), _mm_loadu_ps(p + 24), 1);
+        __m256 p37 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p + 12)), _mm_loadu_ps(p + 28), 1);
+        storeLinearAvx2(p04, p15, p26, p37, i, block);
+    }
+    convertToLinearFloatScalar(src, i, n, block);
+}
+
+static void toLinearHalfAvx2(const _Float16 *src, uint32_t start, uint32_t n, ConvertBlock *block) {
+    uint32_t i = start;
+    for (; i + 8 <= n; i += 8) {
+        const __m128i *p = (const __m128i *) (src + 4 * i);
+        __m256 p01 = _mm256_cvtph_ps(_mm_loadu_si128(p + 0));
+        __m256 p23 = _mm256_cvtph_ps(_mm_loadu_si128(p + 1));
+        __m256 p45 = _mm256_cvtph_ps(_mm_loadu_si128(p + 2));
+        __m256 p67 = _mm256_cvtph_ps(_mm_loadu_si128(p + 3));
+        storeLinearAvx2(_mm256_permute2f128_ps(p01, p45, 0x20), _mm256_permute2f128_ps(p01, p45, 0x31),
+                        _mm256_permute2f128_ps(p23, p67, 0x20), _mm256_permute2f128_ps(p23, p67, 0x31),
+                        i, block);
+    }
+    convertToLinearHalfScalar(src, i, n, block);
+}
+
+static void pqAvx2Row(float *v, uint32_t n) {
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(v + i, pqAvx2(_mm256_loadu_ps(v + i)));
+    }
+    convertPqScalar(v + i, n - i);
+}
+
+static void pqLutAvx2Row(float *v, uint32_t n) {
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 y = _mm256_min_ps(_mm256_set1_ps(1), _mm256_max_ps(_mm256_loadu_ps(v + i), _mm256_set1_ps(FLT_MIN)));
+        __m256i bits = _mm256_castps_si256(y);
+        __m256i idx = _mm256_srli_epi32(_mm256_sub_epi32(bits, _mm256_set1_epi32(0x00800000)), PQ_LUT_SHIFT);
+        __m256 weight = _mm256_mul_ps(
+                _mm256_cvtepi32_ps(_mm256_and_si256(bits, _mm256_set1_epi32((1 << PQ_LUT_SHIFT) - 1))),
+                _mm256_set1_ps(1.f / (1 << PQ_LUT_SHIFT)));
+        __m256 lo = _mm256_i32gather_ps(pqLut, idx, 4);
+        __m256 hi = _mm256_i32gather_ps(pqLut + 1, idx, 4);
+        _mm256_storeu_ps(v + i, _mm256_fmadd_ps(weight, _mm256_sub_ps(hi, lo), lo));
+    }
+    convertPqLutScalar(v + i, n - i);
+}
+
+const ConvertKernel convertKernelAvx2 = {
+        "avx2",
+        toLinearFloatAvx2,
+        toLinearHalfAvx2,
+        pqAvx2Row,
+        pqLutAvx2Row,
+};
+
+#endif
@@ -0,0 +1,153 @@
+// AVX-512 conversion kernel, 16 pixels per iteration. Same math as the AVX2 kernel on 512-bit vectors.
+// Built with -mavx512f -mavx512bw -mavx512vl and only selected at runtime if the CPU supports it.
+#include "convert.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+#include <float.h>
+#include <immintrin.h>
+
+static inline __m512 log2SeriesAvx512(__m512 t) {
+    __m512 t2 = _mm512_mul_ps(t, t);
+    __m512 p = _mm512_set1_ps(0.32059889f);
+    p = _mm512_fmadd_ps(p, t2, _mm512_set1_ps(0.41219858f));
+    p = _mm512_fmadd_ps(p, t2, _mm512_set1_ps(0.57707802f));
+    p = _mm512_fmadd_ps(p, t2, _mm512_set1_ps(0.96179669f));
+    p = _mm512_fmadd_ps(p, t2, _mm512_set1_ps(2.88539008f));
+    return _mm512_mul_ps(p, t);
+}
+
+static inline __m512 log2Avx512(__m512 x) {
+    __m512i xi = _mm512_castps_si512(x);
+    __m512i e = _mm512_sub_epi32(_mm512_srli_epi32(xi, 23), _mm512_set1_epi32(127));
+    __m512 m = _mm512_castsi512_ps(_mm512_or_si512(_mm512_and_si512(xi, _mm512_set1_epi32(0x7fffff)),
+                                                   _mm512_set1_epi32(0x3f800000)));
+
+    __mmask16 big = _mm512_cmp_ps_mask(m, _mm512_set1_ps(1.41421356f), _CMP_GT_OQ);
+    m = _mm512_mask_mul_ps(m, big, m, _mm512_set1_ps(0.5f));
+    e = _mm512_mask_add_epi32(e, big, e, _mm512_set1_epi32(1));
+
+    __m512 t = _mm512_div_ps(_mm512_sub_ps(m, _mm512_set1_ps(1)), _mm512_add_ps(m, _mm512_set1_ps(1)));
+    return _mm512_add_ps(log2SeriesAvx512(t), _mm512_cvtepi32_ps(e));
+}
+
+static inline __m512 exp2Avx512(__m512 x) {
+    x = _mm512_max_ps(x, _mm512_set1_ps(-126));
+    __m512 n = _mm512_roundscale_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m512 f = _mm512_sub_ps(x, n);
+
+    __m512 p = _mm512_set1_ps(1.5252734e-5f);
+    p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(1.5403530e-4f));
+    p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(1.3333558e-3f));
+    p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(9.6181291e-3f));
+    p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(5.5504109e-2f));
+    p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(2.4022651e-1f));
+    p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(6.9314718e-1f));
+    p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(1));
+
+    __m512i scale = _mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127)), 23);
+    return _mm512_mul_ps(p, _mm512_castsi512_ps(scale));
+}
+
+static inline __m512 pqAvx512(__m512 y) {
+    const __m512 m1 = _mm512_set1_ps(1305 / 8192.f);
+    const __m512 m2 = _mm512_set1_ps(2523 / 32.f);
+    const __m512 c3 = _mm512_set1_ps(2392 / 128.f);
+    const __m512 one = _mm512_set1_ps(1);
+
+    __m512 ym1 = exp2Avx512(_mm512_mul_ps(m1, log2Avx512(_mm512_max_ps(y, _mm512_set1_ps(FLT_MIN)))));
+
+    // See pqAvx2() for why the ratio is handled as 1 - d
+    __m512 d = _mm512_div_ps(_mm512_mul_ps(_mm512_set1_ps(21 / 128.f), _mm512_sub_ps(one, ym1)),
+                             _mm512_fmadd_ps(c3, ym1, one));
+    __m512 t = _mm512_div_ps(d, _mm512_sub_ps(d, _mm512_set1_ps(2)));
+    return exp2Avx512(_mm512_mul_ps(m2, log2SeriesAvx512(t)));
+}
+
+// p0 to p3 hold four RGBA pixels each, in order
+static inline void storeLinearAvx512(__m512 p0, __m512 p1, __m512 p2, __m512 p3, uint32_t i, ConvertBlock *block) {
+    // r0..r7 g0..g7, and the same for b/a, then for pixels 8..15
+    const __m512i evenRg = _mm512_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28, 1, 5, 9, 13, 17, 21, 25, 29);
+    const __m512i evenBa = _mm512_setr_epi32(2, 6, 10, 14, 18, 22, 26, 30, 3, 7, 11, 15, 19, 23, 27, 31);
+    const __m512i lowHalves = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 16, 17, 18, 19, 20, 21, 22, 23);
+    const __m512i highHalves = _mm512_setr_epi32(8, 9, 10, 11, 12, 13, 14, 15, 24, 25, 26, 27, 28, 29, 30, 31);
+
+    __m512 rg01 = _mm512_permutex2var_ps(p0, evenRg, p1);
+    __m512 rg23 = _mm512_permutex2var_ps(p2, evenRg, p3);
+    __m512 ba01 = _mm512_permutex2var_ps(p0, evenBa, p1);
+    __m512 ba23 = _mm512_permutex2var_ps(p2, evenBa, p3);
+    __m512 in[3] = {
+            _mm512_permutex2var_ps(rg01, lowHalves, rg23),
+            _mm512_permutex2var_ps(rg01, highHalves, rg23),
+            _mm512_permutex2var_ps(ba01, lowHalves, ba23),
+    };
+
+    // Rounded exactly like the scalar kernel, see convert_avx2.c
+    __m512 out[3];
+    for (int k = 0; k < 3; k++) {
+        __m512 res = _mm512_mul_ps(_mm512_set1_ps(scrgb_to_bt2100[k][0]), in[0]);
+        res = _mm512_add_ps(_mm512_mul_ps(_mm512_set1_ps(scrgb_to_bt2100[k][1]), in[1]), res);
+        res = _mm512_add_ps(_mm512_mul_ps(_mm512_set1_ps(scrgb_to_bt2100[k][2]), in[2]), res);
+        out[k] = _mm512_min_ps(_mm512_set1_ps(1), _mm512_max_ps(res, _mm512_setzero_ps()));
+    }
+
+    _mm512_storeu_ps(block->r + i, out[0]);
+    _mm512_storeu_ps(block->g + i, out[1]);
+    _mm512_storeu_ps(block->b + i, out[2]);
+    _mm512_storeu_ps(block->maxComp + i, _mm512_max_ps(out[0], _mm512_max_ps(out[1], out[2])));
+}
+
+static void toLinearFloatAvx512(const float *src, uint32_t start, uint32_t n, ConvertBlock *block) {
+    uint32_t i = start;
+    for (; i + 16 <= n; i += 16) {
+        const float *p = src + 4 * i;
+        storeLinearAvx512(_mm512_loadu_ps(p), _mm512_loadu_ps(p + 16), _mm512_loadu_ps(p + 32),
+                          _mm512_loadu_ps(p + 48), i, block);
+    }
+    convertToLinearFloatScalar(src, i, n, block);
+}
+
+static void toLinearHalfAvx512(const _Float16 *src, uint32_t start, uint32_t n, ConvertBlock *block) {
+    uint32_t i = start;
+    for (; i + 16 <= n; i += 16) {
+        const __m256i *p = (const __m256i *) (src + 4 * i);
+        storeLinearAvx512(_mm512_cvtph_ps(_mm256_loadu_si256(p)), _mm512_cvtph_ps(_mm256_loadu_si256(p + 1)),
+                          _mm512_cvtph_ps(_mm256_loadu_si256(p + 2)), _mm512_cvtph_ps(_mm256_loadu_si256(p + 3)),
+                          i, block);
+    }
+    convertToLinearHalfScalar(src, i, n, block);
+}
+
+static void pqAvx512Row(float *v, uint32_t n) {
+    uint32_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(v + i, pqAvx512(_mm512_loadu_ps(v + i)));
+    }
+    convertPqScalar(v + i, n - i);
+}
+
+static void pqLutAvx512Row(float *v, uint32_t n) {
+    uint32_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 y = _mm512_min_ps(_mm512_set1_ps(1), _mm512_max_ps(_mm512_loadu_ps(v + i), _mm512_set1_ps(FLT_MIN)));
+        __m512i bits = _mm512_castps_si512(y);
+        __m512i idx = _mm512_srli_epi32(_mm512_sub_epi32(bits, _mm512_set1_epi32(0x00800000)), PQ_LUT_SHIFT);
+        __m512 weight = _mm512_mul_ps(
+                _mm512_cvtepi32_ps(_mm512_and_si512(bits, _mm512_set1_epi32((1 << PQ_LUT_SHIFT) - 1))),
+                _mm512_set1_ps(1.f / (1 << PQ_LUT_SHIFT)));
+        __m512 lo = _mm512_i32gather_ps(idx, pqLut, 4);
+        __m512 hi = _mm512_i32gather_ps(idx, pqLut + 1, 4);
+        _mm512_storeu_ps(v + i, _mm512_fmadd_ps(weight, _mm512_sub_ps(hi, lo), lo));
+    }
+    convertPqLutScalar(v + i, n - i);
+}
+
+const ConvertKernel convertKernelAvx512 = {
+        "avx512",
+        toLinearFloatAvx512,
+        toLinearHalfAvx512,
+        pqAvx512Row,
+        pqLutAvx512Row,
+};
+
+#endif
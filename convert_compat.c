@@ -0,0 +1,54 @@
+// Bit-exact version of what the encoder got before the conversion threads wrote YUV themselves: PQ values
+// rounded to 16-bit RGB, then converted by avifImageRGBToYUV() (4:4:4, full range, built-in path). The
+// arithmetic follows libavif's reformat.c operation by operation, so this file is built without -ffast-math.
+#include "convert.h"
+
+#include <math.h>
+
+// libavif's avifRoundf()
+static float roundHalfUp(float v) {
+    return floorf(v + 0.5f);
+}
+
+static uint16_t toUnorm(float v, float range, float bias, int maxChannel) {
+    int unorm = (int) roundHalfUp(v * range + bias);
+    return (uint16_t) (unorm < 0 ? 0 : unorm > maxChannel ? maxChannel : unorm);
+}
+
+// The intermediate 16-bit RGB value, normalized the way libavif reads it back
+static float rgb16(float v) {
+    return (float) (uint16_t) roundf(v * 65535) / 65535.0f;
+}
+
+void convertStoreYuvLibavif(const ConvertBlock *block, uint32_t n, uint32_t depth, uint16_t *y, uint16_t *u,
+                            uint16_t *v) {
+    const float kr = 0.2627f;
+    const float kb = 0.0593f;
+    const float kg = 1.0f - kr - kb;
+    const int maxChannel = (1 << depth) - 1;
+    const float range = (float) maxChannel;
+    const float biasUV = (float) (1 << (depth - 1));
+
+    for (uint32_t i = 0; i < n; i++) {
+        float r = rgb16(block->r[i]);
+        float g = rgb16(block->g[i]);
+        float b = rgb16(block->b[i]);
+
+        float luma = (kr * r) + (kg * g) + (kb * b);
+        y[i] = toUnorm(luma, range, 0.0f, maxChannel);
+        u[i] = toUnorm((b - luma) / (2 * (1 - kb)), range, biasUV, maxChannel);
+        v[i] = toUnorm((r - luma) / (2 * (1 - kr)), range, biasUV, maxChannel);
+    }
+}
+
+void convertStoreGbrLibavif(const ConvertBlock *block, uint32_t n, uint32_t depth, uint16_t *y, uint16_t *u,
+                            uint16_t *v) {
+    const int maxChannel = (1 << depth) - 1;
+    const float range = (float) maxChannel;
+
+    for (uint32_t i = 0; i < n; i++) {
+        y[i] = toUnorm(rgb16(block->g[i]), range, 0.0f, maxChannel);
+        u[i] = toUnorm(rgb16(block->b[i]), range, 0.0f, maxChannel);
+        v[i] = toUnorm(rgb16(block->r[i]), range, 0.0f, maxChannel);
+    }
+}
@@ -0,0 +1,126 @@
+// NEON conversion kernel for AArch64, 8 pixels per iteration. Same math as the AVX2 kernel.
+#include "convert.h"
+
+#if defined(__aarch64__)
+
+#include <arm_neon.h>
+#include <float.h>
+
+static inline float32x4_t log2SeriesNeon(float32x4_t t) {
+    float32x4_t t2 = vmulq_f32(t, t);
+    float32x4_t p = vdupq_n_f32(0.32059889f);
+    p = vfmaq_f32(vdupq_n_f32(0.41219858f), p, t2);
+    p = vfmaq_f32(vdupq_n_f32(0.57707802f), p, t2);
+    p = vfmaq_f32(vdupq_n_f32(0.96179669f), p, t2);
+    p = vfmaq_f32(vdupq_n_f32(2.88539008f), p, t2);
+    return vmulq_f32(p, t);
+}
+
+static inline float32x4_t log2Neon(float32x4_t x) {
+    int32x4_t xi = vreinterpretq_s32_f32(x);
+    int32x4_t e = vsubq_s32(vshrq_n_s32(xi, 23), vdupq_n_s32(127));
+    float32x4_t m = vreinterpretq_f32_s32(vorrq_s32(vandq_s32(xi, vdupq_n_s32(0x7fffff)),
+                                                    vdupq_n_s32(0x3f800000)));
+
+    uint32x4_t big = vcgtq_f32(m, vdupq_n_f32(1.41421356f));
+    m = vbslq_f32(big, vmulq_n_f32(m, 0.5f), m);
+    e = vsubq_s32(e, vreinterpretq_s32_u32(big)); // big is all ones, i.e. -1
+
+    float32x4_t one = vdupq_n_f32(1);
+    float32x4_t t = vdivq_f32(vsubq_f32(m, one), vaddq_f32(m, one));
+    return vaddq_f32(log2SeriesNeon(t), vcvtq_f32_s32(e));
+}
+
+static inline float32x4_t exp2Neon(float32x4_t x) {
+    x = vmaxq_f32(x, vdupq_n_f32(-126));
+    float32x4_t n = vrndnq_f32(x);
+    float32x4_t f = vsubq_f32(x, n);
+
+    float32x4_t p = vdupq_n_f32(1.5252734e-5f);
+    p = vfmaq_f32(vdupq_n_f32(1.5403530e-4f), p, f);
+    p = vfmaq_f32(vdupq_n_f32(1.3333558e-3f), p, f);
+    p = vfmaq_f32(vdupq_n_f32(9.6181291e-3f), p, f);
+    p = vfmaq_f32(vdupq_n_f32(5.5504109e-2f), p, f);
+    p = vfmaq_f32(vdupq_n_f32(2.4022651e-1f), p, f);
+    p = vfmaq_f32(vdupq_n_f32(6.9314718e-1f), p, f);
+    p = vfmaq_f32(vdupq_n_f32(1), p, f);
+
+    int32x4_t scale = vshlq_n_s32(vaddq_s32(vcvtq_s32_f32(n), vdupq_n_s32(127)), 23);
+    return vmulq_f32(p, vreinterpretq_f32_s32(scale));
+}
+
+static inline float32x4_t pqNeon(float32x4_t y) {
+    const float m1 = 1305 / 8192.f;
+    const float m2 = 2523 / 32.f;
+    const float c3 = 2392 / 128.f;
+    const float32x4_t one = vdupq_n_f32(1);
+
+    float32x4_t ym1 = exp2Neon(vmulq_n_f32(log2Neon(vmaxq_f32(y, vdupq_n_f32(FLT_MIN))), m1));
+
+    // See pqAvx2() for why the ratio is handled as 1 - d
+    float32x4_t d = vdivq_f32(vmulq_n_f32(vsubq_f32(one, ym1), 21 / 128.f), vfmaq_n_f32(one, ym1, c3));
+    float32x4_t t = vdivq_f32(d, vsubq_f32(d, vdupq_n_f32(2)));
+    return exp2Neon(vmulq_n_f32(log2SeriesNeon(t), m2));
+}
+
+static inline void storeLinearNeon(const float32x4_t in[3], uint32_t i, ConvertBlock *block) {
+    float32x4_t out[3];
+    // Rounded exactly like the scalar kernel, see convert_avx2.c
+    for (int k = 0; k < 3; k++) {
+        float32x4_t res = vmulq_n_f32(in[0], scrgb_to_bt2100[k][0]);
+        res = vaddq_f32(vmulq_n_f32(in[1], scrgb_to_bt2100[k][1]), res);
+        res = vaddq_f32(vmulq_n_f32(in[2], scrgb_to_bt2100[k][2]), res);
+        // vmaxnm rather than vmax, which would pass NaN on where the scalar and x86 kernels give 0
+        out[k] = vminq_f32(vdupq_n_f32(1), vmaxnmq_f32(res, vdupq_n_f32(0)));
+    }
+
+    vst1q_f32(block->r + i, out[0]);
+    vst1q_f32(block->g + i, out[1]);
+    vst1q_f32(block->b + i, out[2]);
+    vst1q_f32(block->maxComp + i, vmaxq_f32(out[0], vmaxq_f32(out[1], out[2])));
+}
+
+static void toLinearFloatNeon(const float *src, uint32_t start, uint32_t n, ConvertBlock *block) {
+    uint32_t i = start;
+    for (; i + 8 <= n; i += 8) {
+        for (uint32_t h = 0; h < 8; h += 4) {
+            float32x4x4_t rgba = vld4q_f32(src + 4 * (i + h));
+            storeLinearNeon(rgba.val, i + h, block);
+        }
+    }
+    convertToLinearFloatScalar(src, i, n, block);
+}
+
+static void toLinearHalfNeon(const _Float16 *src, uint32_t start, uint32_t n, ConvertBlock *block) {
+    uint32_t i = start;
+    for (; i + 8 <= n; i += 8) {
+        for (uint32_t h = 0; h < 8; h += 4) {
+            uint16x4x4_t rgba = vld4_u16((const uint16_t *) src + 4 * (i + h));
+            float32x4_t in[3];
+            for (int k = 0; k < 3; k++) {
+                in[k] = vcvt_f32_f16(vreinterpret_f16_u16(rgba.val[k]));
+            }
+            storeLinearNeon(in, i + h, block);
+        }
+    }
+    convertToLinearHalfScalar(src, i, n, block);
+}
+
+static void pqNeonRow(float *v, uint32_t n) {
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        vst1q_f32(v + i, pqNeon(vld1q_f32(v + i)));
+        vst1q_f32(v + i + 4, pqNeon(vld1q_f32(v + i + 4)));
+    }
+    convertPqScalar(v + i, n - i);
+}
+
+const ConvertKernel convertKernelNeon = {
+        "neon",
+        toLinearFloatNeon,
+        toLinearHalfNeon,
+        pqNeonRow,
+        convertPqLutScalar, // no gathers, the scalar lookup is as good as it gets
+};
+
+#endif
@@ -0,0 +1,123 @@
+// SSE4.1 + F16C conversion kernel, 4 pixels per iteration, for CPUs without AVX2. Same math as the AVX2
+// kernel without FMA. Built with -msse4.1 -mf16c and only selected at runtime if the CPU supports it.
+#include "convert.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+#include <float.h>
+#include <immintrin.h>
+
+static inline __m128 log2SeriesSse41(__m128 t) {
+    __m128 t2 = _mm_mul_ps(t, t);
+    __m128 p = _mm_set1_ps(0.32059889f);
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(0.41219858f));
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(0.57707802f));
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(0.96179669f));
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(2.88539008f));
+    return _mm_mul_ps(p, t);
+}
+
+static inline __m128 log2Sse41(__m128 x) {
+    __m128i xi = _mm_castps_si128(x);
+    __m128i e = _mm_sub_epi32(_mm_srli_epi32(xi, 23), _mm_set1_epi32(127));
+    __m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(xi, _mm_set1_epi32(0x7fffff)),
+                                             _mm_set1_epi32(0x3f800000)));
+
+    __m128 big = _mm_cmpgt_ps(m, _mm_set1_ps(1.41421356f));
+    m = _mm_blendv_ps(m, _mm_mul_ps(m, _mm_set1_ps(0.5f)), big);
+    e = _mm_sub_epi32(e, _mm_castps_si128(big)); // big is all ones, i.e. -1
+
+    __m128 t = _mm_div_ps(_mm_sub_ps(m, _mm_set1_ps(1)), _mm_add_ps(m, _mm_set1_ps(1)));
+    return _mm_add_ps(log2SeriesSse41(t), _mm_cvtepi32_ps(e));
+}
+
+static inline __m128 exp2Sse41(__m128 x) {
+    x = _mm_max_ps(x, _mm_set1_ps(-126));
+    __m128 n = _mm_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m128 f = _mm_sub_ps(x, n);
+
+    __m128 p = _mm_set1_ps(1.5252734e-5f);
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.5403530e-4f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.3333558e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.6181291e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.5504109e-2f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.4022651e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.9314718e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1));
+
+    __m128i scale = _mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(p, _mm_castsi128_ps(scale));
+}
+
+static inline __m128 pqSse41(__m128 y) {
+    const __m128 m1 = _mm_set1_ps(1305 / 8192.f);
+    const __m128 m2 = _mm_set1_ps(2523 / 32.f);
+    const __m128 c3 = _mm_set1_ps(2392 / 128.f);
+    const __m128 one = _mm_set1_ps(1);
+
+    __m128 ym1 = exp2Sse41(_mm_mul_ps(m1, log2Sse41(_mm_max_ps(y, _mm_set1_ps(FLT_MIN)))));
+
+    // See pqAvx2() for why the ratio is handled as 1 - d
+    __m128 d = _mm_div_ps(_mm_mul_ps(_mm_set1_ps(21 / 128.f), _mm_sub_ps(one, ym1)),
+                          _mm_add_ps(_mm_mul_ps(c3, ym1), one));
+    __m128 t = _mm_div_ps(d, _mm_sub_ps(d, _mm_set1_ps(2)));
+    return exp2Sse41(_mm_mul_ps(m2, log2SeriesSse41(t)));
+}
+
+// p0 to p3 hold one RGBA pixel each
+static inline void storeLinearSse41(__m128 p0, __m128 p1, __m128 p2, __m128 p3, uint32_t i, ConvertBlock *block) {
+    _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+    __m128 in[3] = {p0, p1, p2};
+
+    __m128 out[3];
+    for (int k = 0; k < 3; k++) {
+        __m128 res = _mm_mul_ps(_mm_set1_ps(scrgb_to_bt2100[k][0]), in[0]);
+        res = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(scrgb_to_bt2100[k][1]), in[1]), res);
+        res = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(scrgb_to_bt2100[k][2]), in[2]), res);
+        out[k] = _mm_min_ps(_mm_set1_ps(1), _mm_max_ps(res, _mm_setzero_ps()));
+    }
+
+    _mm_storeu_ps(block->r + i, out[0]);
+    _mm_storeu_ps(block->g + i, out[1]);
+    _mm_storeu_ps(block->b + i, out[2]);
+    _mm_storeu_ps(block->maxComp + i, _mm_max_ps(out[0], _mm_max_ps(out[1], out[2])));
+}
+
+static void toLinearFloatSse41(const float *src, uint32_t start, uint32_t n, ConvertBlock *block) {
+    uint32_t i = start;
+    for (; i + 4 <= n; i += 4) {
+        const float *p = src + 4 * i;
+        storeLinearSse41(_mm_loadu_ps(p), _mm_loadu_ps(p + 4), _mm_loadu_ps(p + 8), _mm_loadu_ps(p + 12), i, block);
+    }
+    convertToLinearFloatScalar(src, i, n, block);
+}
+
+static void toLinearHalfSse41(const _Float16 *src, uint32_t start, uint32_t n, ConvertBlock *block) {
+    uint32_t i = start;
+    for (; i + 4 <= n; i += 4) {
+        const __m128i *p = (const __m128i *) (src + 4 * i);
+        __m128i p01 = _mm_loadu_si128(p);
+        __m128i p23 = _mm_loadu_si128(p + 1);
+        storeLinearSse41(_mm_cvtph_ps(p01), _mm_cvtph_ps(_mm_unpackhi_epi64(p01, p01)),
+                         _mm_cvtph_ps(p23), _mm_cvtph_ps(_mm_unpackhi_epi64(p23, p23)), i, block);
+    }
+    convertToLinearHalfScalar(src, i, n, block);
+}
+
+static void pqSse41Row(float *v, uint32_t n) {
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(v + i, pqSse41(_mm_loadu_ps(v + i)));
+    }
+    convertPqScalar(v + i, n - i);
+}
+
+const ConvertKernel convertKernelSse41 = {
+        "sse41",
+        toLinearFloatSse41,
+        toLinearHalfSse41,
+        pqSse41Row,
+        convertPqLutScalar, // no gathers before AVX2
+};
+
+#endif
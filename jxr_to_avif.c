@@ -0,0 +1,107 @@
+#include "jxr_to_avif.h"
+
+#include <stdio.h>
+
+#include "pipeline.h"
+#include "platform.h"
+
+void jxrToAvifOptionsInit(JxrToAvifOptions *options) {
+    ConvertOptions defaults;
+    convertOptionsInit(&defaults);
+
+    options->speed = defaults.speed;
+    options->depth = defaults.depth;
+    options->format = JXR_TO_AVIF_FORMAT_YUV444;
+    options->maxCll = JXR_TO_AVIF_MAXCLL_PERCENTILE;
+    options->pool = NULL;
+}
+
+// Runs the pipeline with the defaults of the command line for everything the options don't cover
+static int convert(const JxrToAvifOptions *options, PixelSource *source, avifRWData *output, JxrToAvifInfo *info) {
+    if (options->speed < AVIF_SPEED_SLOWEST || options->speed > AVIF_SPEED_FASTEST ||
+        (options->depth != 10 && options->depth != 12)) {
+        fprintf(stderr, "Invalid options\n");
+        pixelSourceDestroy(source);
+        return 1;
+    }
+
+    ConvertOptions convertOptions;
+    convertOptionsInit(&convertOptions);
+    convertOptions.speed = options->speed;
+    convertOptions.depth = options->depth;
+    convertOptions.format = options->format == JXR_TO_AVIF_FORMAT_RGB ? CONVERT_FORMAT_RGB : CONVERT_FORMAT_YUV444;
+    switch (options->maxCll) {
+        case JXR_TO_AVIF_MAXCLL_TRUE:
+            convertOptions.maxCllMode = MAXCLL_MODE_TRUE;
+            break;
+        case JXR_TO_AVIF_MAXCLL_NONE:
+            convertOptions.maxCllMode = MAXCLL_MODE_NONE;
+            break;
+        default:
+            convertOptions.maxCllMode = MAXCLL_MODE_PERCENTILE;
+            break;
+    }
+
+    ThreadPool *pool = options->pool;
+    if (pool == NULL) {
+        pool = poolCreate(cpuCount());
+        if (pool == NULL) {
+            fprintf(stderr, "Failed to create thread pool\n");
+            pixelSourceDestroy(source);
+            return 1;
+        }
+    }
+
+    uint32_t width = source->width;
+    uint32_t height = source->height;
+    ConvertResult result;
+    int returnCode = convertSource(&convertOptions, source, pool, 0, output, &result);
+
+    if (returnCode == 0 && info) {
+        info->width = width;
+        info->height = height;
+        info->maxCLL = result.maxCLL;
+        info->trueMaxCLL = result.trueMaxCLL;
+        info->maxPALL = result.maxPALL;
+    }
+
+    if (pool != options->pool) {
+        poolDestroy(pool);
+    }
+    return returnCode;
+}
+
+int jxrToAvifConvertBuffer(const JxrToAvifOptions *options, const uint8_t *data, size_t size, avifRWData *output,
+                           JxrToAvifInfo *info) {
+    PixelSource *source = pixelSourceOpenBuffer(data, size);
+    if (source == NULL) {
+        return 1;
+    }
+    return convert(options, source, output, info);
+}
+
+int jxrToAvifConvertPixels(const JxrToAvifOptions *options, const void *pixels, uint32_t width, uint32_t height,
+                           uint8_t bytesPerColor, size_t stride, avifRWData *output, JxrToAvifInfo *info) {
+    if (pixels == NULL) {
+        fprintf(stderr, "No pixels given\n");
+        return 1;
+    }
+    if (width == 0 || height == 0) {
+        fprintf(stderr, "Invalid image size: %ux%u\n", width, height);
+        return 1;
+    }
+    if (bytesPerColor != 2 && bytesPerColor != 4) {
+        fprintf(stderr, "Invalid bytes per color: %u, must be 2 or 4\n", bytesPerColor);
+        return 1;
+    }
+    if (stride / 4 / bytesPerColor < width) {
+        fprintf(stderr, "Row stride of %zu bytes is too small for %u pixels\n", stride, width);
+        return 1;
+    }
+
+    PixelSource *source = pixelSourceOpenMemory(pixels, width, height, bytesPerColor, stride);
+    if (source == NULL) {
+        return 1;
+    }
+    return convert(options, source, output, info);
+}
@@ -0,0 +1,58 @@
+#ifndef JXR_TO_AVIF_JXR_TO_AVIF_H
+#define JXR_TO_AVIF_JXR_TO_AVIF_H
+
+// Converts HDR images to AVIF in memory, the library behind the command line tool. Errors are printed to stderr.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "avif.h"
+#include "pool.h"
+
+typedef enum JxrToAvifFormat {
+    JXR_TO_AVIF_FORMAT_YUV444, // BT.2020 non-constant luminance
+    JXR_TO_AVIF_FORMAT_RGB,    // identity matrix, a much larger file
+} JxrToAvifFormat;
+
+typedef enum JxrToAvifMaxCll {
+    JXR_TO_AVIF_MAXCLL_PERCENTILE, // light level of the 99.99 percentile brightest pixel
+    JXR_TO_AVIF_MAXCLL_TRUE,       // brightest pixel, as defined by H.274
+    JXR_TO_AVIF_MAXCLL_NONE,       // no HDR metadata
+} JxrToAvifMaxCll;
+
+typedef struct JxrToAvifOptions {
+    int speed; // AVIF_SPEED_SLOWEST to AVIF_SPEED_FASTEST
+    uint32_t depth; // 10 or 12
+    JxrToAvifFormat format;
+    JxrToAvifMaxCll maxCll;
+    // Threads for conversion and encoding, which may be shared by many conversions that run one after another.
+    // If NULL, a pool with one thread per CPU is created for every call.
+    ThreadPool *pool;
+} JxrToAvifOptions;
+
+// What a conversion found, light levels in nits
+typedef struct JxrToAvifInfo {
+    uint32_t width;
+    uint32_t height;
+    uint16_t maxCLL; // the value written, unless there is no HDR metadata
+    uint16_t trueMaxCLL;
+    uint16_t maxPALL;
+} JxrToAvifInfo;
+
+// Sets the defaults of the command line: default speed, 12 bits, YUV 4:4:4, percentile MaxCLL and no pool
+void jxrToAvifOptionsInit(JxrToAvifOptions *options);
+
+// Converts an image file in memory: JPEG XR (or anything else WIC understands, only on Windows) or a PFM-style
+// dump. The data is only read. info may be NULL. Returns 0 on success, in which case output must be freed with
+// avifRWDataFree().
+int jxrToAvifConvertBuffer(const JxrToAvifOptions *options, const uint8_t *data, size_t size, avifRWData *output,
+                           JxrToAvifInfo *info);
+
+// Converts scRGB pixels in memory, RGBA as 32-bit floats (bytesPerColor == 4) or 16-bit half floats
+// (bytesPerColor == 2), top row first with consecutive rows stride bytes apart, at least width * bytesPerColor * 4.
+// Alpha is ignored. info may be NULL. Returns 0 on success, in which case output must be freed with
+// avifRWDataFree().
+int jxrToAvifConvertPixels(const JxrToAvifOptions *options, const void *pixels, uint32_t width, uint32_t height,
+                           uint8_t bytesPerColor, size_t stride, avifRWData *output, JxrToAvifInfo *info);
+
+#endif // JXR_TO_AVIF_JXR_TO_AVIF_H
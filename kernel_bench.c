@@ -0,0 +1,304 @@
+// Times every variant of the conversion kernels on one thread and measures their error against the scalar
+// reference, printing one line of CSV per variant and buffer size
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "convert.h"
+#include "platform.h"
+
+#define DEFAULT_CACHE_PIXELS 4096  // 64 KB of float pixels, which stay in L2
+#define DEFAULT_DRAM_PIXELS (1 << 24)  // 256 MB of float pixels, far beyond any cache
+#define DEFAULT_SECONDS 0.5  // minimum run time of every measurement
+#define ACCURACY_PIXELS (1 << 20)
+#define ACCURACY_SWEEP (1 << 20)  // PQ inputs spread evenly over log2 in [2^-30, 1]
+
+// Both in code values at 16 and 12 bits, against the reference before quantization
+typedef struct KernelError {
+    double max16;
+    double mean16;
+    double max12;
+    double mean12;
+} KernelError;
+
+typedef struct LinearVariant {
+    const char *name;
+    void (*toLinearFloat)(const float *src, uint32_t start, uint32_t n, ConvertBlock *block);
+    void (*toLinearHalf)(const _Float16 *src, uint32_t start, uint32_t n, ConvertBlock *block);
+} LinearVariant;
+
+static volatile float sink; // keeps the results of the timed loops alive
+
+// scRGB pixels like those of HDR screenshots: mostly SDR levels, some highlights up to beyond 10000 nits
+// (125.0) and some slightly negative, out of gamut components
+static void randomPixels(float *pixels, size_t count) {
+    uint32_t state = 0x9e3779b9;
+
+    for (size_t i = 0; i < 4 * count; i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        float x = (float) (state >> 8) / (1 << 24);
+        if (i % 4 == 3) {
+            pixels[i] = 1;
+        } else if (state % 16 == 0) {
+            pixels[i] = -0.1f * x;
+        } else {
+            pixels[i] = exp2f(-12 + 19 * x);
+        }
+    }
+}
+
+static void toHalf(const float *pixels, _Float16 *halfPixels, size_t count) {
+    for (size_t i = 0; i < 4 * count; i++) {
+        halfPixels[i] = (_Float16) pixels[i];
+    }
+}
+
+static void addErrors(KernelError *error, const float *reference, const float *actual, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        double difference = fabs((double) reference[i] - actual[i]);
+        error->max16 = fmax(error->max16, difference * 65535);
+        error->mean16 += difference * 65535;
+        error->max12 = fmax(error->max12, difference * 4095);
+        error->mean12 += difference * 4095;
+    }
+}
+
+static void finishErrors(KernelError *error, size_t count) {
+    error->mean16 /= (double) count;
+    error->mean12 /= (double) count;
+}
+
+// Mpixel/s of converting the pixels to linear, block by block as the pipeline does
+static double timeLinear(const LinearVariant *variant, const void *pixels, size_t count, double seconds) {
+    ConvertBlock block;
+    uint64_t done = 0;
+    double start = platformSeconds();
+    double elapsed;
+
+    do {
+        for (size_t i = 0; i < count; i += CONVERT_BLOCK) {
+            uint32_t n = (uint32_t) min(CONVERT_BLOCK, count - i);
+            if (variant->toLinearFloat) {
+                variant->toLinearFloat((const float *) pixels + 4 * i, 0, n, &block);
+            } else {
+                variant->toLinearHalf((const _Float16 *) pixels + 4 * i, 0, n, &block);
+            }
+            sink = block.maxComp[0];
+        }
+        done += count;
+        elapsed = platformSeconds() - start;
+    } while (elapsed < seconds);
+
+    return (double) done / elapsed / 1e6;
+}
+
+// Mpixel/s of applying PQ to the three planes of the pixels, copied block by block into the scratch space the
+// pipeline uses. values holds the linear values of every pixel, plane by plane.
+static double timePq(void (*pq)(float *v, uint32_t n), const float *values, size_t count, double seconds) {
+    ConvertBlock block;
+    uint64_t done = 0;
+    double start = platformSeconds();
+    double elapsed;
+
+    do {
+        for (size_t i = 0; i < 3 * count; i += CONVERT_BLOCK) {
+            uint32_t n = (uint32_t) min(CONVERT_BLOCK, 3 * count - i);
+            memcpy(block.r, values + i, n * sizeof(float));
+            pq(block.r, n);
+            sink = block.r[0];
+        }
+        done += count;
+        elapsed = platformSeconds() - start;
+    } while (elapsed < seconds);
+
+    return (double) done / elapsed / 1e6;
+}
+
+// Error of the linear values once they are PQ encoded, which is what ends up in the output. Both sides go
+// through the scalar PQ so that only the conversion to linear is measured.
+static KernelError linearError(const LinearVariant *variant, const float *pixels, const _Float16 *halfPixels,
+                               size_t count) {
+    KernelError error = {0};
+
+    for (size_t i = 0; i < count; i += CONVERT_BLOCK) {
+        uint32_t n = (uint32_t) min(CONVERT_BLOCK, count - i);
+        ConvertBlock expected;
+        ConvertBlock actual;
+        if (variant->toLinearFloat) {
+            convertToLinearFloatScalar(pixels + 4 * i, 0, n, &expected);
+            variant->toLinearFloat(pixels + 4 * i, 0, n, &actual);
+        } else {
+            convertToLinearHalfScalar(halfPixels + 4 * i, 0, n, &expected);
+            variant->toLinearHalf(halfPixels + 4 * i, 0, n, &actual);
+        }
+
+        float *expectedPlanes[3] = {expected.r, expected.g, expected.b};
+        float *actualPlanes[3] = {actual.r, actual.g, actual.b};
+        for (int k = 0; k < 3; k++) {
+            convertPqScalar(expectedPlanes[k], n);
+            convertPqScalar(actualPlanes[k], n);
+            addErrors(&error, expectedPlanes[k], actualPlanes[k], n);
+        }
+    }
+
+    finishErrors(&error, 3 * count);
+    return error;
+}
+
+static KernelError pqError(void (*pq)(float *v, uint32_t n), const float *values, size_t count) {
+    KernelError error = {0};
+
+    for (size_t i = 0; i < count; i += CONVERT_BLOCK) {
+        uint32_t n = (uint32_t) min(CONVERT_BLOCK, count - i);
+        float reference[CONVERT_BLOCK];
+        float actual[CONVERT_BLOCK];
+        memcpy(reference, values + i, n * sizeof(float));
+        memcpy(actual, values + i, n * sizeof(float));
+        convertPqScalar(reference, n);
+        pq(actual, n);
+        addErrors(&error, reference, actual, n);
+    }
+
+    finishErrors(&error, count);
+    return error;
+}
+
+// Converts the pixels to linear with the scalar kernel, returning the values plane by plane
+static float *linearValues(const float *pixels, size_t count) {
+    float *values = malloc(3 * count * sizeof(float));
+    if (values == NULL) {
+        return NULL;
+    }
+
+    ConvertBlock block;
+    for (size_t i = 0; i < count; i += CONVERT_BLOCK) {
+        uint32_t n = (uint32_t) min(CONVERT_BLOCK, count - i);
+        convertToLinearFloatScalar(pixels + 4 * i, 0, n, &block);
+        memcpy(values + i, block.r, n * sizeof(float));
+        memcpy(values + count + i, block.g, n * sizeof(float));
+        memcpy(values + 2 * count + i, block.b, n * sizeof(float));
+    }
+    return values;
+}
+
+static void printRow(const char *stage, const char *variant, const char *buffer, size_t pixels, double speed,
+                     const KernelError *error) {
+    printf("%s,%s,%s,%zu,%.1f,%.4f,%.5f,%.4f,%.5f\n", stage, variant, buffer, pixels, speed, error->max16,
+           error->mean16, error->max12, error->mean12);
+    fflush(stdout);
+}
+
+static void printUsage(void) {
+    fprintf(stderr, "jxr_to_avif_kernel_bench [--cache-pixels n] [--dram-pixels n] [--seconds s]\n");
+}
+
+int main(int argc, char *argv[]) {
+    size_t bufferPixels[2] = {DEFAULT_CACHE_PIXELS, DEFAULT_DRAM_PIXELS};
+    const char *bufferNames[2] = {"cache", "dram"};
+    double seconds = DEFAULT_SECONDS;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp("--cache-pixels", argv[i]) && i + 1 < argc) {
+            bufferPixels[0] = (size_t) strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp("--dram-pixels", argv[i]) && i + 1 < argc) {
+            bufferPixels[1] = (size_t) strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp("--seconds", argv[i]) && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+    if (bufferPixels[0] == 0 || bufferPixels[1] == 0) {
+        fprintf(stderr, "Buffers must have at least 1 pixel\n");
+        return 1;
+    }
+
+    size_t maxPixels = max(max(bufferPixels[0], bufferPixels[1]), ACCURACY_PIXELS);
+    float *pixels = malloc(4 * maxPixels * sizeof(float));
+    _Float16 *halfPixels = malloc(4 * maxPixels * sizeof(_Float16));
+    if (pixels == NULL || halfPixels == NULL) {
+        fprintf(stderr, "Failed to allocate %zu pixels\n", maxPixels);
+        return 1;
+    }
+    randomPixels(pixels, maxPixels);
+    toHalf(pixels, halfPixels, maxPixels);
+
+    // PQ is timed on the linear values of the pixels, and its accuracy measured on those of the accuracy
+    // pixels followed by a sweep over the whole range of the curve
+    float *values = linearValues(pixels, maxPixels);
+    float *accuracyValues = malloc((3 * ACCURACY_PIXELS + ACCURACY_SWEEP + 2) * sizeof(float));
+    if (values == NULL || accuracyValues == NULL) {
+        fprintf(stderr, "Failed to allocate %zu pixels\n", maxPixels);
+        return 1;
+    }
+    memcpy(accuracyValues, values, 3 * ACCURACY_PIXELS * sizeof(float));
+    size_t accuracyCount = 3 * ACCURACY_PIXELS;
+    for (uint32_t i = 0; i < ACCURACY_SWEEP; i++) {
+        accuracyValues[accuracyCount++] = exp2f(-30 + 30.f * (float) i / ACCURACY_SWEEP);
+    }
+    accuracyValues[accuracyCount++] = 0;
+    accuracyValues[accuracyCount++] = 1;
+
+    convertPqLutInit();
+    convertHalfLutInit();
+
+    printf("stage,variant,buffer,pixels,mpix_per_s,max_err_16,mean_err_16,max_err_12,mean_err_12\n");
+
+    // Conversion of float and half pixels to linear BT.2100, which is mostly the color matrix
+    for (int half = 0; half < 2; half++) {
+        const char *stage = half ? "linear_half" : "linear_float";
+        LinearVariant variants[16];
+        int variantCount = 0;
+
+        for (const ConvertKernel *const *kernel = convertKernels; *kernel; kernel++) {
+            if (convertKernelSupported(*kernel)) {
+                LinearVariant *variant = &variants[variantCount++];
+                variant->name = (*kernel)->name;
+                variant->toLinearFloat = half ? NULL : (*kernel)->toLinearFloat;
+                variant->toLinearHalf = half ? (*kernel)->toLinearHalf : NULL;
+            }
+        }
+        if (half) {
+            variants[variantCount++] = (LinearVariant) {"lut", NULL, convertToLinearHalfLut};
+        }
+
+        for (int v = 0; v < variantCount; v++) {
+            KernelError error = linearError(&variants[v], pixels, halfPixels, ACCURACY_PIXELS);
+            for (int b = 0; b < 2; b++) {
+                const void *src = half ? (const void *) halfPixels : (const void *) pixels;
+                double speed = timeLinear(&variants[v], src, bufferPixels[b], seconds);
+                printRow(stage, variants[v].name, bufferNames[b], bufferPixels[b], speed, &error);
+            }
+        }
+    }
+
+    // PQ, both computed and interpolated from the table, against the scalar kernel
+    for (const ConvertKernel *const *kernel = convertKernels; *kernel; kernel++) {
+        if (!convertKernelSupported(*kernel)) {
+            continue;
+        }
+        for (int lut = 0; lut < 2; lut++) {
+            void (*pq)(float *v, uint32_t n) = lut ? (*kernel)->pqLut : (*kernel)->pq;
+            char name[64];
+            snprintf(name, sizeof(name), "%s%s", (*kernel)->name, lut ? "_lut" : "");
+
+            KernelError error = pqError(pq, accuracyValues, accuracyCount);
+            for (int b = 0; b < 2; b++) {
+                // Any 3 * pixels of the values make a buffer of as many pixels
+                double speed = timePq(pq, values, bufferPixels[b], seconds);
+                printRow("pq", name, bufferNames[b], bufferPixels[b], speed, &error);
+            }
+        }
+    }
+
+    free(accuracyValues);
+    free(values);
+    free(halfPixels);
+    free(pixels);
+    return 0;
+}
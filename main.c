@@ -4,500 +4,814 @@
 // Copyright 2020 Joe Drago. All rights reserved.
 #include <stdio.h>
 #include <string.h>
-#include <windows.h>
-#include <wincodec.h>
-#include <math.h>
+#include <stdlib.h>
 #include <stdint.h>
+#include <stdatomic.h>
+#include <ctype.h>
 
 #include "avif.h"
+#include "convert.h"
+#include "pipeline.h"
+#include "pixel_source.h"
+#include "platform.h"
+#include "pool.h"
+#include "serve.h"
+#include "trace.h"
+
+#define BATCH_THREADS_PER_FILE 4  // lossless encodes scale poorly beyond a few threads, so batches run files side by side
+
+#define WATCH_DEFAULT_DEBOUNCE 500  // ms a new file must stay unchanged before it is converted
+#define WATCH_RESCAN 5000  // ms between scans without notifications, which network shares don't always send
+
+#define SERVE_QUEUE_PER_JOB 2  // requests accepted per conversion running, enough to always have the next one read
+
+static void printUsage(void) {
+    fprintf(stderr, "jxr_to_avif [--speed n] [--depth 10|12] [--format yuv444|rgb] [--maxcll percentile|true|none] "
+                    "[--kernel name] [--half auto|arith|lut] [--pq auto|exact|lut] [--yuv fused|libavif] "
+                    "[--band-height n] [--grid auto|off|WxH] input.jxr [output.avif]\n"
+                    "jxr_to_avif [options] [--jobs n] --batch input.jxr|directory...\n"
+                    "jxr_to_avif [options] [--jobs n] [--debounce ms] --watch directory\n"
+                    "jxr_to_avif [options] [--jobs n] [--queue n] --serve socket\n"
+                    "jxr_to_avif [--sample n] --analyze input.jxr|directory...\n"
+                    "jxr_to_avif --self-test\n"
+                    "Any of the above except --watch, --serve and --self-test can take --timings and --trace out.json, "
+                    "conversions also --verify\n");
+}
+
+// Checks the PQ table against its reference, and every kernel the CPU supports and the half float table against
+// the scalar kernel. Returns 0 if all of them pass.
+static int runSelfTest(void) {
+    int failures = convertPqLutSelfTest();
+    failures += convertHalfLutSelfTest();
+    for (const ConvertKernel *const *kernel = convertKernels; *kernel; kernel++) {
+        if (convertKernelSupported(*kernel)) {
+            failures += convertSelfTest(*kernel);
+        } else {
+            printf("%s: not supported by this CPU\n", (*kernel)->name);
+        }
+    }
+    return failures != 0;
+}
 
-#define INTERMEDIATE_BITS 16  // bit depth of the integer texture given to the encoder
-#define DEFAULT_SPEED 6  // 6 is default speed of the command line encoder, so it should be a good value?
-#define USE_TILING AVIF_TRUE  // slightly larger file size, but faster encode and decode
+// Prints s as a JSON string
+static void printJsonString(const char *s) {
+    putchar('"');
+    for (; *s; s++) {
+        unsigned char c = (unsigned char) *s;
+        if (c == '"' || c == '\\') {
+            printf("\\%c", c);
+        } else if (c < 0x20) {
+            printf("\\u%04x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
 
-#define TARGET_BITS 12  // bit depth of the output, should be 10 or 12
-#define TARGET_FORMAT AVIF_PIXEL_FORMAT_YUV444
-//#define TARGET_RGB  // uncomment to output RGB instead of YUV (much larger file size)
+// Computes only the HDR metadata of a file, without PQ conversion or encoding, and prints it as one line of
+// JSON. Returns 0 on success.
+static int analyzeFile(const ConvertOptions *options, const char *inputFile, ThreadPool *pool) {
+    PixelSource *source = pixelSourceOpen(inputFile);
+
+    if (source == NULL) {
+        return 1;
+    }
 
-#define MAXCLL_PERCENTILE 0.9999  // comment out to calculate true MaxCLL instead of top percentile
+    ConvertResult result;
 
-static float m1 = 1305 / 8192.f;
-static float m2 = 2523 / 32.f;
-static float c1 = 107 / 128.f;
-static float c2 = 2413 / 128.f;
-static float c3 = 2392 / 128.f;
+    int returnCode = analyzeSource(options, source, pool, &result);
+    if (returnCode == 0) {
+        printf("{\"file\": ");
+        printJsonString(inputFile);
+        printf(", \"width\": %u, \"height\": %u, \"sampleStride\": %u, \"maxCLL\": %u, \"trueMaxCLL\": %u, "
+               "\"maxPALL\": %u}\n", source->width, source->height, options->sampleStride, result.maxCLL,
+               result.trueMaxCLL, result.maxPALL);
+        fflush(stdout);
+    }
 
-float pq_inv_eotf(float y) {
-    return powf((c1 + c2 * powf(y, m1)) / (1 + c3 * powf(y, m1)), m2);
+    pixelSourceDestroy(source);
+    return returnCode;
 }
 
-static const float scrgb_to_bt2100[3][3] = {
-        {2939026994.L / 585553224375.L, 9255011753.L / 3513319346250.L, 173911579.L / 501902763750.L},
-        {76515593.L / 138420033750.L,   6109575001.L / 830520202500.L,  75493061.L / 830520202500.L},
-        {12225392.L / 93230009375.L,    1772384008.L / 2517210253125.L, 18035212433.L / 2517210253125.L},
-};
-
-void matrixVectorMult(const float in[3], float out[3], const float matrix[3][3]) {
-    for (int i = 0; i < 3; i++) {
-        float res = 0;
-        for (int j = 0; j < 3; j++) {
-            res += matrix[i][j] * in[j];
+static int hasExtension(const char *path, const char *extension) {
+    size_t length = strlen(path);
+    size_t extensionLength = strlen(extension);
+    if (length < extensionLength) {
+        return 0;
+    }
+    for (size_t i = 0; i < extensionLength; i++) {
+        if (tolower((unsigned char) path[length - extensionLength + i]) != extension[i]) {
+            return 0;
         }
-        out[i] = res;
     }
+    return 1;
 }
 
-float saturate(float x) {
-    return min(1, max(x, 0));
+static int compareStrings(const void *a, const void *b) {
+    return strcmp(*(const char **) a, *(const char **) b);
 }
 
-typedef struct ThreadData {
-    uint8_t *pixels;
-    uint16_t *converted;
-    uint32_t width;
-    uint32_t start;
-    uint32_t stop;
-    double sumOfMaxComp;
-#ifdef MAXCLL_PERCENTILE
-    uint32_t *nitCounts;
-#endif
-    uint16_t maxNits;
-    uint8_t bytesPerColor;
-} ThreadData;
-
-DWORD WINAPI ThreadFunc(LPVOID lpParam) {
-    ThreadData *d = (ThreadData *) lpParam;
-    uint8_t *pixels = d->pixels;
-    uint8_t bytesPerColor = d->bytesPerColor;
-    uint16_t *converted = d->converted;
-    uint32_t width = d->width;
-    uint32_t start = d->start;
-    uint32_t stop = d->stop;
-
-    float maxMaxComp = 0;
-    double sumOfMaxComp = 0;
-
-    for (uint32_t i = start; i < stop; i++) {
-        for (uint32_t j = 0; j < width; j++) {
-            float bt2020[3];
-
-            if (bytesPerColor == 4) {
-                matrixVectorMult((float *) pixels + i * 4 * width + 4 * j, bt2020, scrgb_to_bt2100);
-            } else {
-                float cur[3];
-                _Float16 *cur16 = (_Float16 *) pixels + i * 4 * width + 4 * j;
-                for (int k = 0; k < 3; k++) {
-                    cur[k] = (float) cur16[k];
-                }
-                matrixVectorMult(cur, bt2020, scrgb_to_bt2100);
-            }
-
-            for (int k = 0; k < 3; k++) {
-                bt2020[k] = saturate(bt2020[k]);
-            }
+// Returns 1 if the file is JPEG XR or PFM, judging by its extension
+static int isInputFile(const char *path) {
+    static const char *extensions[] = {".jxr", ".wdp", ".hdp", ".pfm"};
 
-            float maxComp = max(bt2020[0], max(bt2020[1], bt2020[2]));
+    for (size_t k = 0; k < sizeof(extensions) / sizeof(extensions[0]); k++) {
+        if (hasExtension(path, extensions[k])) {
+            return 1;
+        }
+    }
+    return 0;
+}
 
-#ifdef MAXCLL_PERCENTILE
-            uint32_t nits = (uint32_t) roundf(maxComp * 10000);
-            d->nitCounts[nits]++;
-#endif
-            if (maxComp > maxMaxComp) {
-                maxMaxComp = maxComp;
+// Expands directories among the batch (or --analyze) inputs to the JPEG XR and PFM files they contain, sorted by name.
+// Files given directly are kept as they are. Returns 0 on success.
+static int collectBatchInputs(char **inputs, uint32_t count, char ***filesOut, uint32_t *fileCountOut) {
+    char **files = NULL;
+    uint32_t fileCount = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        int isDirectory = platformIsDirectory(inputs[i]);
+        char **entries = &inputs[i];
+        int entryCount = 1;
+
+        if (isDirectory) {
+            entryCount = platformListDirectory(inputs[i], &entries);
+            if (entryCount < 0) {
+                fprintf(stderr, "Failed to list directory %s\n", inputs[i]);
+                return 1;
             }
+        }
 
-            sumOfMaxComp += maxComp;
+        char **grown = realloc(files, sizeof(char *) * (fileCount + entryCount + 1));
+        if (grown == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+        files = grown;
 
-            for (int k = 0; k < 3; k++) {
-                converted[(size_t) 3 * width * i + (size_t) 3 * j + k] = (uint16_t) roundf(
-                        pq_inv_eotf(bt2020[k]) * ((1 << INTERMEDIATE_BITS) - 1));
+        uint32_t first = fileCount;
+        for (int j = 0; j < entryCount; j++) {
+            if (!isDirectory || isInputFile(entries[j])) {
+                files[fileCount++] = entries[j];
+            } else {
+                free(entries[j]);
             }
         }
-    }
+        qsort(files + first, fileCount - first, sizeof(char *), compareStrings);
 
-    d->maxNits = (uint16_t) roundf(maxMaxComp * 10000);
-    d->sumOfMaxComp = sumOfMaxComp;
+        if (isDirectory) {
+            free(entries);
+        }
+    }
 
+    *filesOut = files;
+    *fileCountOut = fileCount;
     return 0;
 }
 
-int main(int argc, char *argv[]) {
-    if (argc <= 1 || argc > 3 == strcmp(argv[1], "--speed") || argc > 5) {
-        fprintf(stderr, "jxr_to_avif [--speed n] input.jxr [output.avif]\n");
-        return 1;
+// Returns the input path with its extension replaced by .avif, free() the result
+static char *batchOutputPath(const char *input) {
+    size_t length = strlen(input);
+    const char *dot = strrchr(input, '.');
+    if (dot != NULL && strpbrk(dot, "/\\") == NULL) {
+        length = dot - input;
     }
+    char *output = malloc(length + sizeof(".avif"));
+    if (output != NULL) {
+        memcpy(output, input, length);
+        strcpy(output + length, ".avif");
+    }
+    return output;
+}
 
-    int speed = DEFAULT_SPEED;
-    LPWSTR inputFile;
-    LPWSTR outputFile = L"output.avif";
-
-    {
-        LPWSTR *szArglist;
-        int nArgs;
+typedef struct BatchQueue {
+    const ConvertOptions *options;
+    char **inputs;
+    uint32_t count;
+    uint32_t threadsPerFile;
+    int verify;
+    atomic_uint next;
+    atomic_uint failures;
+} BatchQueue;
+
+// Worker of the batch scheduler: converts files from the queue until it is empty, all on the same pool. With
+// verification, every file is verified on that pool too once it is encoded, so the workers never run more
+// threads than their share.
+static int BatchFunc(void *arg) {
+    BatchQueue *q = (BatchQueue *) arg;
+
+    ThreadPool *pool = poolCreate(q->threadsPerFile);
+    if (pool == NULL) {
+        fprintf(stderr, "Failed to create thread pool\n");
+        return 1;
+    }
 
-        szArglist = CommandLineToArgvW(GetCommandLineW(), &nArgs);
-        if (NULL == szArglist) {
-            fprintf(stderr, "CommandLineToArgvW failed\n");
-            return 1;
+    while (1) {
+        uint32_t i = atomic_fetch_add(&q->next, 1);
+        if (i >= q->count) {
+            break;
         }
 
-        int rest = 1;
-
-        if (!strcmp("--speed", argv[1])) {
-            speed = atoi(argv[2]);
-            if (speed < AVIF_SPEED_SLOWEST || speed > AVIF_SPEED_FASTEST) {
-                fprintf(stderr, "Speed must be in range [%d, %d]", AVIF_SPEED_SLOWEST, AVIF_SPEED_FASTEST);
-                return 1;
+        const char *input = q->inputs[i];
+        char *output = batchOutputPath(input);
+        avifRWData avif = AVIF_DATA_EMPTY;
+        if (output == NULL || convertFile(q->options, input, output, pool, 0, q->verify ? &avif : NULL)) {
+            fprintf(stderr, "Failed to convert %s\n", input);
+            atomic_fetch_add(&q->failures, 1);
+        } else {
+            printf("Wrote: %s\n", output);
+            if (q->verify && verifyFile(input, &avif, pool, stdout)) {
+                fprintf(stderr, "Failed to verify %s\n", input);
+                atomic_fetch_add(&q->failures, 1);
             }
-            rest += 2;
         }
+        avifRWDataFree(&avif);
+        free(output);
+    }
 
-        inputFile = szArglist[rest + 0];
+    poolDestroy(pool);
+    return 0;
+}
 
-        if (rest + 1 < argc) {
-            outputFile = szArglist[rest + 1];
+// Runs all inputs through jobs concurrent workers that split the threads between them. Returns the number
+// of files that failed.
+static uint32_t runBatch(const ConvertOptions *options, char **inputs, uint32_t count, uint32_t numThreads,
+                         uint32_t jobs, int verify) {
+    if (jobs == 0) {
+        jobs = max(1, numThreads / BATCH_THREADS_PER_FILE);
+    }
+    jobs = min(jobs, count);
+
+    BatchQueue q;
+    q.options = options;
+    q.inputs = inputs;
+    q.count = count;
+    q.threadsPerFile = max(1, numThreads / jobs);
+    q.verify = verify;
+    atomic_init(&q.next, 0);
+    atomic_init(&q.failures, 0);
+
+    printf("Converting %u files, %u at a time with %u threads each\n", count, jobs, q.threadsPerFile);
+
+    Thread workers[jobs];
+    uint32_t started = 0;
+
+    for (; started < jobs; started++) {
+        if (threadCreate(&workers[started], BatchFunc, &q)) {
+            fprintf(stderr, "Failed to create thread\n");
+            break;
         }
     }
 
-    // Create a decoder
-    IWICBitmapDecoder *pDecoder = NULL;
+    if (started == 0) {
+        return count;
+    }
 
-    // Initialize COM
-    CoInitialize(NULL);
+    int workersFailed = 0;
+    for (uint32_t i = 0; i < started; i++) {
+        workersFailed |= threadJoin(&workers[i]) != 0;
+    }
 
-    // The factory pointer
-    IWICImagingFactory *pFactory = NULL;
+    // Files left in the queue if workers could not start their pools
+    uint32_t next = atomic_load(&q.next);
+    uint32_t unprocessed = workersFailed && next < count ? count - next : 0;
+    return atomic_load(&q.failures) + unprocessed;
+}
 
-    // Create the COM imaging factory
-    HRESULT hr = CoCreateInstance(
-            &CLSID_WICImagingFactory,
-            NULL,
-            CLSCTX_INPROC_SERVER,
-            &IID_IWICImagingFactory,
-            (void **) &pFactory);
+typedef enum WatchState {
+    WATCH_PENDING, // waiting for the file to stay unchanged for the debounce time
+    WATCH_QUEUED,  // waiting for or being converted by a worker
+    WATCH_DONE,    // converted, or failed to, and only converted again if it changes
+} WatchState;
+
+// An input file in the watched directory
+typedef struct WatchFile {
+    char *path;
+    uint64_t size;
+    int64_t modified;
+    double changed; // when the size or modification time last changed, as seen by the scans
+    WatchState state;
+    struct WatchFile *next; // in the queue
+} WatchFile;
+
+typedef struct WatchQueue {
+    const ConvertOptions *options;
+    int verify;
+    Mutex mutex; // guards the queue and the state of every file
+    CondVar cond;
+    WatchFile *head;
+    WatchFile *tail;
+} WatchQueue;
+
+typedef struct WatchWorker {
+    WatchQueue *q;
+    ThreadPool *pool;
+    Thread thread;
+} WatchWorker;
+
+// Worker of the watch mode: converts queued files for as long as the process runs, all on the same pool
+static int WatchFunc(void *arg) {
+    WatchWorker *worker = (WatchWorker *) arg;
+    WatchQueue *q = worker->q;
+
+    while (1) {
+        mutexLock(&q->mutex);
+        while (q->head == NULL) {
+            condWait(&q->cond, &q->mutex);
+        }
+        WatchFile *file = q->head;
+        q->head = file->next;
+        if (q->head == NULL) {
+            q->tail = NULL;
+        }
+        mutexUnlock(&q->mutex);
+
+        // Queued files are left alone by the scans, so the path stays valid
+        char *output = batchOutputPath(file->path);
+        avifRWData avif = AVIF_DATA_EMPTY;
+        if (output == NULL || convertFile(q->options, file->path, output, worker->pool, 0,
+                                          q->verify ? &avif : NULL)) {
+            fprintf(stderr, "Failed to convert %s\n", file->path);
+        } else {
+            printf("Wrote: %s\n", output);
+            if (q->verify && verifyFile(file->path, &avif, worker->pool, stdout)) {
+                fprintf(stderr, "Failed to verify %s\n", file->path);
+            }
+        }
+        avifRWDataFree(&avif);
+        free(output);
+        fflush(stdout);
 
-    if (FAILED(hr)) {
-        fprintf(stderr, "Failed to create WIC imaging factory\n");
-        return 1;
+        mutexLock(&q->mutex);
+        file->state = WATCH_DONE;
+        mutexUnlock(&q->mutex);
     }
+    return 0;
+}
 
-    hr = pFactory->lpVtbl->CreateDecoderFromFilename(
-            pFactory,
-            inputFile,                       // Image to be decoded
-            NULL,                            // Do not prefer a particular vendor
-            GENERIC_READ,                    // Desired read access to the file
-            WICDecodeMetadataCacheOnDemand,  // Cache metadata when needed
-            &pDecoder                        // Pointer to the decoder
-    );
+static int compareWatchFiles(const void *a, const void *b) {
+    return strcmp((*(WatchFile *const *) a)->path, (*(WatchFile *const *) b)->path);
+}
 
-    if (FAILED(hr)) {
-        fprintf(stderr, "Failed to open file\n");
-        return 1;
+// Matches the input files of the directory against the known ones, sorted by path, and queues those that have
+// stayed unchanged for the debounce time. Files without an output are new, others were converted before.
+// Returns the time in ms until the next pending file is due, or UINT32_MAX if there is none.
+static uint32_t scanWatchedDirectory(WatchQueue *q, const char *directory, WatchFile ***files, uint32_t *count,
+                                     uint32_t debounce) {
+    char **entries;
+    int entryCount = platformListDirectory(directory, &entries);
+    if (entryCount < 0) {
+        fprintf(stderr, "Failed to list directory %s\n", directory);
+        return UINT32_MAX;
     }
+    qsort(entries, entryCount, sizeof(char *), compareStrings);
 
-    // Retrieve the first frame of the image from the decoder
-    IWICBitmapFrameDecode *pFrame = NULL;
+    WatchFile **merged = malloc(sizeof(WatchFile *) * (*count + entryCount + 1));
+    if (merged == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        for (int j = 0; j < entryCount; j++) {
+            free(entries[j]);
+        }
+        free(entries);
+        return UINT32_MAX;
+    }
 
-    hr = pDecoder->lpVtbl->GetFrame(pDecoder, 0, &pFrame);
+    double now = platformSeconds();
+    uint32_t wait = UINT32_MAX;
+    uint32_t mergedCount = 0;
+    uint32_t i = 0;
+    int j = 0;
 
-    if (FAILED(hr)) {
-        fprintf(stderr, "Failed to get frame\n");
-        return 1;
-    }
+    mutexLock(&q->mutex);
 
-    IWICBitmapSource *pBitmapSource = NULL;
+    while (i < *count || j < entryCount) {
+        if (j < entryCount && !isInputFile(entries[j])) {
+            free(entries[j++]);
+            continue;
+        }
+        int order = i == *count ? 1 : j == entryCount ? -1 : strcmp((*files)[i]->path, entries[j]);
 
-    hr = pFrame->lpVtbl->QueryInterface(pFrame, &IID_IWICBitmapSource, (void **) &pBitmapSource);
+        if (order < 0) {
+            // Gone from the directory, but a worker may still be using it
+            WatchFile *file = (*files)[i++];
+            if (file->state == WATCH_QUEUED) {
+                merged[mergedCount++] = file;
+            } else {
+                free(file->path);
+                free(file);
+            }
+            continue;
+        }
 
-    if (FAILED(hr)) {
-        fprintf(stderr, "Failed to get IWICBitmapSource\n");
-        return 1;
+        WatchFile *file;
+        if (order > 0) {
+            file = calloc(1, sizeof(WatchFile));
+            if (file == NULL || platformFileInfo(entries[j], &file->size, &file->modified)) {
+                free(file);
+                free(entries[j++]);
+                continue;
+            }
+            file->path = entries[j++];
+            file->changed = now;
+
+            uint64_t outputSize;
+            int64_t outputModified;
+            char *output = batchOutputPath(file->path);
+            file->state = output && !platformFileInfo(output, &outputSize, &outputModified) ? WATCH_DONE
+                                                                                            : WATCH_PENDING;
+            free(output);
+        } else {
+            file = (*files)[i++];
+            free(entries[j++]);
+
+            uint64_t size;
+            int64_t modified;
+            if (file->state != WATCH_QUEUED && !platformFileInfo(file->path, &size, &modified) &&
+                (size != file->size || modified != file->modified)) {
+                file->size = size;
+                file->modified = modified;
+                file->changed = now;
+                file->state = WATCH_PENDING;
+            }
+        }
+        merged[mergedCount++] = file;
+
+        if (file->state == WATCH_PENDING) {
+            double remaining = file->changed + debounce / 1000. - now;
+            if (remaining <= 0) {
+                file->state = WATCH_QUEUED;
+                file->next = NULL;
+                if (q->tail) {
+                    q->tail->next = file;
+                } else {
+                    q->head = file;
+                }
+                q->tail = file;
+                condBroadcast(&q->cond);
+            } else {
+                wait = min(wait, (uint32_t) (remaining * 1000) + 1);
+            }
+        }
     }
 
-    WICPixelFormatGUID pixelFormat;
+    mutexUnlock(&q->mutex);
 
-    hr = pBitmapSource->lpVtbl->GetPixelFormat(pBitmapSource, &pixelFormat);
+    free(entries);
+    free(*files);
+    qsort(merged, mergedCount, sizeof(WatchFile *), compareWatchFiles);
+    *files = merged;
+    *count = mergedCount;
+    return wait;
+}
 
-    if (FAILED(hr)) {
-        fprintf(stderr, "Failed to get pixel format\n");
+// Converts every input file that appears in the directory, or changes, and has stayed unchanged for the
+// debounce time, with jobs workers that split the threads between them. Runs until the process is ended and
+// only returns if it can't start.
+static int runWatch(const ConvertOptions *options, const char *directory, uint32_t numThreads, uint32_t jobs,
+                    uint32_t debounce, int verify) {
+    if (!platformIsDirectory(directory)) {
+        fprintf(stderr, "%s is not a directory\n", directory);
         return 1;
     }
+    if (jobs == 0) {
+        jobs = max(1, numThreads / BATCH_THREADS_PER_FILE);
+    }
+    uint32_t threadsPerFile = max(1, numThreads / jobs);
 
-    uint8_t bytesPerColor;
+    WatchQueue q = {0};
+    q.options = options;
+    q.verify = verify;
+    if (mutexInit(&q.mutex) || condInit(&q.cond)) {
+        fprintf(stderr, "Failed to create mutex\n");
+        return 1;
+    }
 
-    if (IsEqualGUID((void *) &pixelFormat, (void *) &GUID_WICPixelFormat128bppRGBAFloat)) {
-        bytesPerColor = 4;
-    } else if (IsEqualGUID((void *) &pixelFormat, (void *) &GUID_WICPixelFormat64bppRGBAHalf)) {
-        bytesPerColor = 2;
-    } else {
-        fprintf(stderr, "Unsupported pixel format\n");
+    // The pools are set up once and kept warm for every file, only the encoder is created anew for each one
+    WatchWorker *workers = calloc(jobs, sizeof(WatchWorker));
+    if (workers == NULL) {
+        fprintf(stderr, "Out of memory\n");
         return 1;
     }
+    for (uint32_t i = 0; i < jobs; i++) {
+        workers[i].q = &q;
+        workers[i].pool = poolCreate(threadsPerFile);
+        if (workers[i].pool == NULL || threadCreate(&workers[i].thread, WatchFunc, &workers[i])) {
+            fprintf(stderr, "Failed to create thread pool\n");
+            return 1;
+        }
+    }
 
-    uint32_t width, height;
+    DirectoryWatch *watch = platformWatchDirectory(directory);
+    printf("Watching %s%s, converting %u files at a time with %u threads each\n", directory,
+           watch ? "" : " by polling", jobs, threadsPerFile);
+    fflush(stdout);
 
-    hr = pBitmapSource->lpVtbl->GetSize(pBitmapSource, &width, &height);
+    WatchFile **files = NULL;
+    uint32_t fileCount = 0;
 
-    if (FAILED(hr)) {
-        fprintf(stderr, "Failed to get size\n");
-        return 1;
+    while (1) {
+        uint32_t wait = scanWatchedDirectory(&q, directory, &files, &fileCount, debounce);
+        // Without notifications, new files are found by polling at the debounce interval
+        uint32_t timeout = min(wait, watch ? WATCH_RESCAN : max(debounce, 100));
+        platformWatchWait(watch, timeout);
     }
+}
 
-    uint16_t *converted = malloc(sizeof(uint16_t) * width * height * 3);
-
-    if (converted == NULL) {
-        fprintf(stderr, "Failed to allocate converted pixels\n");
+int main(int argc, char *argv[]) {
+    ConvertOptions options;
+    convertOptionsInit(&options);
+
+    const char *kernelName = "auto";
+    const char *halfMode = "auto";
+    PqMode pqMode = PQ_MODE_AUTO;
+    int libavifYuv = 0;
+    int batch = 0;
+    int analyze = 0;
+    int timings = 0;
+    int verify = 0;
+    const char *traceFile = NULL;
+    uint32_t jobs = 0;
+    const char *watchDirectory = NULL;
+    const char *servePath = NULL;
+    uint32_t queueSize = 0;
+    uint32_t debounce = WATCH_DEFAULT_DEBOUNCE;
+    const char *inputFile = NULL;
+    const char *outputFile = "output.avif";
+
+    char **args = platformUtf8Args(argc, argv);
+    if (NULL == args) {
+        fprintf(stderr, "Failed to read command line\n");
         return 1;
     }
 
-    SYSTEM_INFO systemInfo;
-    GetSystemInfo(&systemInfo);
-    uint32_t numThreads = systemInfo.dwNumberOfProcessors;
-    printf("Using %d threads\n", numThreads);
-
-    puts("Converting pixels to BT.2100 PQ...");
-
-    uint16_t maxCLL, maxPALL;
+    char **inputs = calloc(argc, sizeof(char *));
+    uint32_t inputCount = 0;
+    if (inputs == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
 
     {
+        int positional = 0;
+
+        for (int i = 1; i < argc; i++) {
+            if (!strcmp("--speed", args[i]) && i + 1 < argc) {
+                options.speed = atoi(args[++i]);
+                if (options.speed < AVIF_SPEED_SLOWEST || options.speed > AVIF_SPEED_FASTEST) {
+                    fprintf(stderr, "Speed must be in range [%d, %d]\n", AVIF_SPEED_SLOWEST, AVIF_SPEED_FASTEST);
+                    return 1;
+                }
+            } else if (!strcmp("--kernel", args[i]) && i + 1 < argc) {
+                kernelName = args[++i];
+            } else if (!strcmp("--half", args[i]) && i + 1 < argc) {
+                halfMode = args[++i];
+                if (strcmp("auto", halfMode) && strcmp("arith", halfMode) && strcmp("lut", halfMode)) {
+                    fprintf(stderr, "Half mode must be auto, arith or lut\n");
+                    return 1;
+                }
+            } else if (!strcmp("--self-test", args[i])) {
+                return runSelfTest();
+            } else if (!strcmp("--pq", args[i]) && i + 1 < argc) {
+                const char *mode = args[++i];
+                if (!strcmp("auto", mode)) {
+                    pqMode = PQ_MODE_AUTO;
+                } else if (!strcmp("exact", mode)) {
+                    pqMode = PQ_MODE_EXACT;
+                } else if (!strcmp("lut", mode)) {
+                    pqMode = PQ_MODE_LUT;
+                } else {
+                    fprintf(stderr, "PQ mode must be auto, exact or lut\n");
+                    return 1;
+                }
+            } else if (!strcmp("--yuv", args[i]) && i + 1 < argc) {
+                const char *mode = args[++i];
+                if (!strcmp("fused", mode)) {
+                    libavifYuv = 0;
+                } else if (!strcmp("libavif", mode)) {
+                    libavifYuv = 1;
+                } else {
+                    fprintf(stderr, "YUV mode must be fused or libavif\n");
+                    return 1;
+                }
+            } else if (!strcmp("--depth", args[i]) && i + 1 < argc) {
+                options.depth = (uint32_t) strtoul(args[++i], NULL, 10);
+                if (options.depth != 10 && options.depth != 12) {
+                    fprintf(stderr, "Depth must be 10 or 12\n");
+                    return 1;
+                }
+            } else if (!strcmp("--format", args[i]) && i + 1 < argc) {
+                const char *format = args[++i];
+                if (!strcmp("yuv444", format)) {
+                    options.format = CONVERT_FORMAT_YUV444;
+                } else if (!strcmp("rgb", format)) {
+                    options.format = CONVERT_FORMAT_RGB;
+                } else {
+                    fprintf(stderr, "Format must be yuv444 or rgb\n");
+                    return 1;
+                }
+            } else if (!strcmp("--maxcll", args[i]) && i + 1 < argc) {
+                const char *mode = args[++i];
+                if (!strcmp("percentile", mode)) {
+                    options.maxCllMode = MAXCLL_MODE_PERCENTILE;
+                } else if (!strcmp("true", mode)) {
+                    options.maxCllMode = MAXCLL_MODE_TRUE;
+                } else if (!strcmp("none", mode)) {
+                    options.maxCllMode = MAXCLL_MODE_NONE;
+                } else {
+                    fprintf(stderr, "MaxCLL mode must be percentile, true or none\n");
+                    return 1;
+                }
+            } else if (!strcmp("--band-height", args[i]) && i + 1 < argc) {
+                options.bandHeight = (uint32_t) strtoul(args[++i], NULL, 10);
+            } else if (!strcmp("--grid", args[i]) && i + 1 < argc) {
+                const char *grid = args[++i];
+                if (!strcmp("auto", grid)) {
+                    options.cellWidth = options.cellHeight = 0;
+                } else if (!strcmp("off", grid)) {
+                    options.cellWidth = options.cellHeight = UINT32_MAX;
+                } else if (sscanf(grid, "%ux%u", &options.cellWidth, &options.cellHeight) != 2 ||
+                           options.cellWidth < GRID_MIN_CELL || options.cellHeight < GRID_MIN_CELL) {
+                    fprintf(stderr, "Grid must be auto, off or a cell size of at least %dx%d\n", GRID_MIN_CELL,
+                            GRID_MIN_CELL);
+                    return 1;
+                }
+            } else if (!strcmp("--verify", args[i])) {
+                verify = 1;
+            } else if (!strcmp("--timings", args[i])) {
+                timings = 1;
+            } else if (!strcmp("--trace", args[i]) && i + 1 < argc) {
+                traceFile = args[++i];
+            } else if (!strcmp("--batch", args[i])) {
+                batch = 1;
+            } else if (!strcmp("--jobs", args[i]) && i + 1 < argc) {
+                jobs = (uint32_t) strtoul(args[++i], NULL, 10);
+            } else if (!strcmp("--watch", args[i]) && i + 1 < argc) {
+                watchDirectory = args[++i];
+            } else if (!strcmp("--serve", args[i]) && i + 1 < argc) {
+                servePath = args[++i];
+            } else if (!strcmp("--queue", args[i]) && i + 1 < argc) {
+                queueSize = (uint32_t) strtoul(args[++i], NULL, 10);
+            } else if (!strcmp("--debounce", args[i]) && i + 1 < argc) {
+                debounce = (uint32_t) strtoul(args[++i], NULL, 10);
+            } else if (!strcmp("--analyze", args[i])) {
+                analyze = 1;
+            } else if (!strcmp("--sample", args[i]) && i + 1 < argc) {
+                options.sampleStride = (uint32_t) strtoul(args[++i], NULL, 10);
+                if (options.sampleStride == 0) {
+                    fprintf(stderr, "Sample stride must be at least 1\n");
+                    return 1;
+                }
+            } else {
+                inputs[inputCount++] = args[i];
+                positional++;
+            }
+        }
 
-        UINT cbStride = width * bytesPerColor * 4;
-        UINT cbBufferSize = cbStride * height;
+        if (watchDirectory || servePath) {
+            if (positional != 0 || batch || analyze || (watchDirectory && servePath)) {
+                printUsage();
+                return 1;
+            }
+            // Neither would ever be finished
+            if (timings || traceFile) {
+                fprintf(stderr, "--timings and --trace can't be used with --%s\n", servePath ? "serve" : "watch");
+                return 1;
+            }
+            if (servePath && verify) {
+                fprintf(stderr, "--verify can't be used with --serve\n");
+                return 1;
+            }
+        } else if (!batch && !analyze) {
+            if (positional == 0 || positional > 2) {
+                printUsage();
+                return 1;
+            }
+            inputFile = inputs[0];
+            if (positional == 2) {
+                outputFile = inputs[1];
+            } else if (!strcmp("-", inputFile)) {
+                // A pipe continues into one
+                outputFile = "-";
+            }
+        } else if (positional == 0) {
+            printUsage();
+            return 1;
+        }
+    }
 
-        uint8_t *pixels = malloc(cbBufferSize);
+    uint32_t numThreads = cpuCount();
 
-        if (converted == NULL) {
-            fprintf(stderr, "Failed to allocate float pixels\n");
+    if (!strcmp("auto", kernelName)) {
+        options.kernel = convertKernelBest();
+    } else {
+        options.kernel = convertKernelByName(kernelName);
+        if (options.kernel == NULL) {
+            fprintf(stderr, "Kernel must be auto or one of:");
+            for (const ConvertKernel *const *kernel = convertKernels; *kernel; kernel++) {
+                fprintf(stderr, " %s", (*kernel)->name);
+            }
+            fprintf(stderr, "\n");
             return 1;
         }
-
-        WICRect rc;
-        rc.Y = 0;
-        rc.X = 0;
-        rc.Width = (int) width;
-        rc.Height = (int) height;
-        hr = pBitmapSource->lpVtbl->CopyPixels(pBitmapSource,
-                                               &rc,
-                                               cbStride,
-                                               cbBufferSize,
-                                               pixels);
-
-        if (FAILED(hr)) {
-            fprintf(stderr, "Failed to copy pixels\n");
-            exit(1);
+        if (!convertKernelSupported(options.kernel)) {
+            fprintf(stderr, "The %s kernel is not supported by this CPU\n", options.kernel->name);
+            return 1;
         }
+    }
+    // Without F16C, looking the halves up beats converting them
+    if (!strcmp("lut", halfMode) || (!strcmp("auto", halfMode) && options.kernel == &convertKernelScalar)) {
+        convertHalfLutInit();
+        options.toLinearHalf = convertToLinearHalfLut;
+    } else {
+        options.toLinearHalf = options.kernel->toLinearHalf;
+    }
+    options.pq = convertPqFunc(options.kernel, pqMode);
+    options.libavifYuv = libavifYuv;
 
-        uint32_t convThreads = min(numThreads, 64);
+    if (timings || traceFile) {
+        options.trace = traceCreate(traceFile != NULL);
+        if (options.trace == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+    }
 
-        uint32_t chunkSize = height / convThreads;
+    char **files = NULL;
+    uint32_t fileCount = 0;
+    int returnCode = 0;
+    // Keeps stdout to the JSON lines, one per file, or to the output file
+    FILE *messages = analyze || (!batch && !strcmp("-", outputFile)) ? stderr : stdout;
 
-        if (chunkSize == 0) {
-            convThreads = height;
-            chunkSize = 1;
+    if (analyze) {
+        if (collectBatchInputs(inputs, inputCount, &files, &fileCount)) {
+            return 1;
         }
+        ThreadPool *pool = poolCreate(numThreads);
+        if (pool == NULL) {
+            fprintf(stderr, "Failed to create thread pool\n");
+            return 1;
+        }
+        uint32_t failures = 0;
+        for (uint32_t i = 0; i < fileCount; i++) {
+            if (analyzeFile(&options, files[i], pool)) {
+                fprintf(stderr, "Failed to analyze %s\n", files[i]);
+                failures++;
+            }
+        }
+        poolDestroy(pool);
+        returnCode = failures || fileCount == 0;
+    } else {
+        fprintf(messages, "Using %d threads\n", numThreads);
+        fprintf(messages, "Using %s conversion kernel\n", options.kernel->name);
 
-        HANDLE hThreadArray[convThreads];
-        ThreadData *threadData[convThreads];
-        DWORD dwThreadIdArray[convThreads];
-
-        for (uint32_t i = 0; i < convThreads; i++) {
-            threadData[i] = malloc(sizeof(ThreadData));
-            if (threadData[i] == NULL) {
-                fprintf(stderr, "Failed to allocate thread data\n");
+        if (servePath) {
+            if (jobs == 0) {
+                jobs = max(1, numThreads / BATCH_THREADS_PER_FILE);
+            }
+            returnCode = runServer(&options, servePath, numThreads, jobs,
+                                   queueSize ? queueSize : jobs * SERVE_QUEUE_PER_JOB);
+        } else if (watchDirectory) {
+            returnCode = runWatch(&options, watchDirectory, numThreads, jobs, debounce, verify);
+        } else if (!batch) {
+            ThreadPool *pool = poolCreate(numThreads);
+            if (pool == NULL) {
+                fprintf(stderr, "Failed to create thread pool\n");
                 return 1;
             }
-
-            threadData[i]->pixels = pixels;
-            threadData[i]->bytesPerColor = bytesPerColor;
-            threadData[i]->converted = converted;
-            threadData[i]->width = width;
-            threadData[i]->start = i * chunkSize;
-            if (i != convThreads - 1) {
-                threadData[i]->stop = (i + 1) * chunkSize;
-            } else {
-                threadData[i]->stop = height;
+            avifRWData avifOutput = AVIF_DATA_EMPTY;
+            returnCode = convertFile(&options, inputFile, outputFile, pool, messages == stdout,
+                                     verify ? &avifOutput : NULL);
+            if (returnCode == 0 && verify) {
+                returnCode = verifyFile(inputFile, &avifOutput, pool, messages);
             }
-
-#ifdef MAXCLL_PERCENTILE
-            threadData[i]->nitCounts = calloc(10000, sizeof(typeof(threadData[i]->nitCounts[0])));
-#endif
-
-            HANDLE hThread = CreateThread(
-                    NULL,                   // default security attributes
-                    0,                      // use default stack size
-                    ThreadFunc,       // thread function name
-                    threadData[i],          // argument to thread function
-                    0,                      // use default creation flags
-                    &dwThreadIdArray[i]);   // returns the thread identifier
-
-            if (hThread) {
-                hThreadArray[i] = hThread;
-            } else {
-                fprintf(stderr, "Failed to create thread\n");
+            avifRWDataFree(&avifOutput);
+            poolDestroy(pool);
+        } else {
+            if (collectBatchInputs(inputs, inputCount, &files, &fileCount)) {
                 return 1;
             }
-        }
-
-        WaitForMultipleObjects(convThreads, hThreadArray, TRUE, INFINITE);
-
-        maxCLL = 0;
-        double sumOfMaxComp = 0;
-
-        for (uint32_t i = 0; i < convThreads; i++) {
-            HANDLE hThread = hThreadArray[i];
-
-            DWORD exitCode;
-            if (!GetExitCodeThread(hThread, &exitCode) || exitCode) {
-                fprintf(stderr, "Thread failed to terminate properly\n");
+            if (fileCount == 0) {
+                fprintf(stderr, "No input files found\n");
                 return 1;
             }
-            CloseHandle(hThread);
 
-            uint16_t tMaxNits = threadData[i]->maxNits;
-            if (tMaxNits > maxCLL) {
-                maxCLL = tMaxNits;
+            uint32_t failures = runBatch(&options, files, fileCount, numThreads, jobs, verify);
+            if (failures) {
+                fprintf(stderr, "%u of %u files failed\n", failures, fileCount);
+                returnCode = 1;
             }
-
-            sumOfMaxComp += threadData[i]->sumOfMaxComp;
         }
+    }
 
-#ifdef MAXCLL_PERCENTILE
-        uint16_t currentIdx = maxCLL;
-        uint64_t count = 0;
-        uint64_t countTarget = (uint64_t) round((1 - MAXCLL_PERCENTILE) * (double) ((uint64_t) width * height));
-        while (1) {
-            for (uint32_t i = 0; i < convThreads; i++) {
-                count += threadData[i]->nitCounts[currentIdx];
-            }
-            if (count >= countTarget) {
-                maxCLL = currentIdx;
-                break;
-            }
-            currentIdx--;
+    if (options.trace) {
+        if (timings) {
+            tracePrintTimings(options.trace, messages);
         }
-#endif
-
-        for (uint32_t i = 0; i < convThreads; i++) {
-#ifdef MAXCLL_PERCENTILE
-            free(threadData[i]->nitCounts);
-#endif
-            free(threadData[i]);
+        if (traceFile && traceWrite(options.trace, traceFile)) {
+            returnCode = 1;
         }
-
-        maxPALL = (uint16_t) round(10000 * (sumOfMaxComp / (double) ((uint64_t) width * height)));
-
-        free(pixels);
+        traceDestroy(options.trace);
     }
-
-    int returnCode = 1;
-    avifEncoder *encoder = NULL;
-    avifRWData avifOutput = AVIF_DATA_EMPTY;
-    avifRGBImage rgb;
-    memset(&rgb, 0, sizeof(rgb));
-
-    avifImage *image = avifImageCreate(width, height, TARGET_BITS,
-                                       TARGET_FORMAT); // these values dictate what goes into the final AVIF
-    if (!image) {
-        fprintf(stderr, "Out of memory\n");
-        goto cleanup;
-    }
-    // Configure image here: (see avif/avif.h)
-    // * colorPrimaries
-    // * transferCharacteristics
-    // * matrixCoefficients
-    // * avifImageSetProfileICC()
-    // * avifImageSetMetadataExif()
-    // * avifImageSetMetadataXMP()
-    // * yuvRange
-    // * alphaPremultiplied
-    // * transforms (transformFlags, pasp, clap, irot, imir)
-    image->colorPrimaries = AVIF_COLOR_PRIMARIES_BT2020;
-    image->transferCharacteristics = AVIF_TRANSFER_CHARACTERISTICS_SMPTE2084;
-
-#ifdef TARGET_RGB
-    image->matrixCoefficients = AVIF_MATRIX_COEFFICIENTS_IDENTITY;
-#else
-    image->matrixCoefficients = AVIF_MATRIX_COEFFICIENTS_BT2020_NCL;
-#endif
-
-    printf("Computed HDR metadata: %u MaxCLL, %u MaxPALL\n", maxCLL, maxPALL);
-
-    image->clli.maxCLL = maxCLL;
-    image->clli.maxPALL = maxPALL;
-
-    // If you have RGB(A) data you want to encode, use this path
-    printf("Doing AVIF encoding...\n");
-
-    avifRGBImageSetDefaults(&rgb, image);
-    // Override RGB(A)->YUV(A) defaults here:
-    //   depth, format, chromaDownsampling, avoidLibYUV, ignoreAlpha, alphaPremultiplied, etc.
-    rgb.format = AVIF_RGB_FORMAT_RGB;
-    rgb.depth = INTERMEDIATE_BITS;
-    rgb.pixels = (void *) converted;
-    rgb.rowBytes = 3 * sizeof(uint16_t) * width;
-
-    avifResult convertResult = avifImageRGBToYUV(image, &rgb);
-    if (convertResult != AVIF_RESULT_OK) {
-        fprintf(stderr, "Failed to convert to YUV(A): %s\n", avifResultToString(convertResult));
-        goto cleanup;
-    }
-
-    free(rgb.pixels);
-
-    encoder = avifEncoderCreate();
-    if (!encoder) {
-        fprintf(stderr, "Out of memory\n");
-        goto cleanup;
-    }
-    // Configure your encoder here (see avif/avif.h):
-    // * maxThreads
-    // * quality
-    // * qualityAlpha
-    // * tileRowsLog2
-    // * tileColsLog2
-    // * speed
-    // * keyframeInterval
-    // * timescale
-    encoder->quality = AVIF_QUALITY_LOSSLESS;
-    encoder->qualityAlpha = AVIF_QUALITY_LOSSLESS;
-    encoder->speed = speed;
-    encoder->maxThreads = (int) numThreads;
-    encoder->autoTiling = USE_TILING;
-
-    // Call avifEncoderAddImage() for each image in your sequence
-    // Only set AVIF_ADD_IMAGE_FLAG_SINGLE if you're not encoding a sequence
-    // Use avifEncoderAddImageGrid() instead with an array of avifImage* to make a grid image
-    avifResult addImageResult = avifEncoderAddImage(encoder, image, 1, AVIF_ADD_IMAGE_FLAG_SINGLE);
-    if (addImageResult != AVIF_RESULT_OK) {
-        fprintf(stderr, "Failed to add image to encoder: %s\n", avifResultToString(addImageResult));
-        goto cleanup;
-    }
-
-    avifResult finishResult = avifEncoderFinish(encoder, &avifOutput);
-    if (finishResult != AVIF_RESULT_OK) {
-        fprintf(stderr, "Failed to finish encode: %s\n", avifResultToString(finishResult));
-        goto cleanup;
-    }
-
-    printf("Encode success: %zu total bytes\n", avifOutput.size);
-
-    FILE *f = _wfopen(outputFile, L"wb");
-    size_t bytesWritten = fwrite(avifOutput.data, 1, avifOutput.size, f);
-    fclose(f);
-    if (bytesWritten != avifOutput.size) {
-        fprintf(stderr, "Failed to write %zu bytes\n", avifOutput.size);
-        goto cleanup;
-    }
-    printf("Wrote: %ls\n", outputFile);
-
-    returnCode = 0;
-    cleanup:
-    if (image) {
-        avifImageDestroy(image);
-    }
-    if (encoder) {
-        avifEncoderDestroy(encoder);
-    }
-    avifRWDataFree(&avifOutput);
     return returnCode;
 }
@@ -0,0 +1,777 @@
+// adapted from avif-example-encode.c, see libavif license in LICENSE-THIRD-PARTY
+// original copyright notice follows
+
+// Copyright 2020 Joe Drago. All rights reserved.
+#include "pipeline.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+
+#include "container.h"
+#include "platform.h"
+#include "stats.h"
+#include "verify.h"
+
+#define DEFAULT_SPEED 6  // 6 is default speed of the command line encoder, so it should be a good value?
+#define USE_TILING AVIF_TRUE  // slightly larger file size, but faster encode and decode
+
+#define DEFAULT_DEPTH 12  // bit depth of the output, 10 or 12
+
+#define MAXCLL_PERCENTILE 0.9999  // brightest pixel that counts in MAXCLL_MODE_PERCENTILE
+#define MAXCLL_BINS_PER_NIT 1  // histogram resolution of the percentile, more bins give sub-nit precision
+
+#define GRID_MAX_WIDTH 16384  // largest frame of AV1 level 6.x, bigger images are split into a grid of cells
+#define GRID_MAX_HEIGHT 8704
+
+#define DEFAULT_BAND_HEIGHT 64  // rows per work item of the conversion, 0 splits the image into one slice per thread
+
+// Per-thread state of a conversion, indexed by pool worker
+typedef struct ThreadData {
+    PixelSource *source; // this thread's fork of the input, opened when it converts its first band
+    uint8_t *band;
+} ThreadData;
+
+typedef struct ConvertJob {
+    const ConvertKernel *kernel;
+    void (*toLinearHalf)(const _Float16 *src, uint32_t start, uint32_t n, ConvertBlock *block);
+    void (*pq)(float *v, uint32_t n);
+    void (*store)(const ConvertBlock *block, uint32_t n, uint32_t depth, uint16_t *y, uint16_t *u, uint16_t *v);
+    PixelSource *source; // if it can fork, every thread decodes the bands it converts through its own fork
+    const uint8_t *pixels; // otherwise, the band that starts at firstRow, decoded by a BandDecoder
+    uint32_t firstRow; // added to the items of poolRun(), which only covers one band without forks
+    avifImage *image; // NULL to only compute the statistics
+    uint32_t depth;
+    uint32_t width;
+    uint32_t bandHeight;
+    uint32_t sampleStride; // only every n-th row is read, work items count sampled rows
+    uint8_t bytesPerColor;
+    ThreadData *threads;
+    LightStats *stats;
+    Trace *trace;
+    atomic_int failed;
+} ConvertJob;
+
+// Decodes the sampled rows [begin, end) of the source into dst, with consecutive rows stride bytes apart.
+// Returns 0 on success.
+static int decodeRows(PixelSource *source, uint32_t begin, uint32_t end, uint32_t sampleStride, uint8_t *dst,
+                      size_t stride) {
+    if (sampleStride == 1) {
+        return source->copyRows(source, begin, end - begin, dst, stride);
+    }
+    for (uint32_t i = begin; i < end; i++) {
+        if (source->copyRows(source, i * sampleStride, 1, dst + stride * (i - begin), stride)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Pool task, converts rows [begin, end) into the YUV planes and accumulates their statistics
+static void convertBand(void *arg, uint32_t worker, uint32_t begin, uint32_t end) {
+    ConvertJob *job = (ConvertJob *) arg;
+    ThreadData *d = &job->threads[worker];
+    uint8_t bytesPerColor = job->bytesPerColor;
+    avifImage *image = job->image;
+    uint32_t width = job->width;
+    uint32_t sampleStride = job->sampleStride;
+    size_t stride = (size_t) width * bytesPerColor * 4;
+    begin += job->firstRow;
+    end += job->firstRow;
+
+    if (atomic_load(&job->failed)) {
+        return;
+    }
+
+    // Timing every block costs a few percent, so it is only done when asked for
+    Trace *trace = job->trace;
+    double start = trace ? platformSeconds() : 0;
+    const uint8_t *pixels;
+
+    if (job->source->fork) {
+        if (d->source == NULL) {
+            d->source = job->source->fork(job->source);
+            d->band = malloc(stride * job->bandHeight);
+            if (d->source == NULL || d->band == NULL) {
+                fprintf(stderr, "Failed to set up band decoding\n");
+                atomic_store(&job->failed, 1);
+                return;
+            }
+        }
+        if (decodeRows(d->source, begin, end, sampleStride, d->band, stride)) {
+            atomic_store(&job->failed, 1);
+            return;
+        }
+        pixels = d->band;
+
+        if (trace) {
+            double decoded = platformSeconds();
+            traceSpan(trace, TRACE_DECODE, start, decoded);
+            traceAdd(trace, TRACE_DECODE, 0, decoded - start);
+            start = decoded;
+        }
+    } else {
+        pixels = job->pixels + stride * (begin - job->firstRow);
+    }
+
+    const ConvertKernel *kernel = job->kernel;
+    LightStatsThread *stats = statsThread(job->stats, worker);
+    ConvertBlock block;
+    double times[3] = {0}; // linear, PQ and YUV
+    double t0 = start, t1 = start, t2 = start;
+
+    for (uint32_t i = 0; i < end - begin; i++) {
+        for (uint32_t j = 0; j < width; j += CONVERT_BLOCK) {
+            uint32_t n = min(CONVERT_BLOCK, width - j);
+            const uint8_t *src = pixels + stride * i + (size_t) 4 * bytesPerColor * j;
+
+            if (bytesPerColor == 4) {
+                kernel->toLinearFloat((const float *) src, 0, n, &block);
+            } else {
+                job->toLinearHalf((const _Float16 *) src, 0, n, &block);
+            }
+
+            statsAdd(stats, block.maxComp, n);
+
+            if (trace) {
+                t1 = platformSeconds();
+                times[0] += t1 - t0;
+                t0 = t1;
+            }
+
+            if (image == NULL) {
+                continue;
+            }
+
+            job->pq(block.r, n);
+            job->pq(block.g, n);
+            job->pq(block.b, n);
+
+            if (trace) {
+                t2 = platformSeconds();
+                times[1] += t2 - t1;
+            }
+
+            uint16_t *planes[3];
+            for (int p = 0; p < 3; p++) {
+                planes[p] = (uint16_t *) (image->yuvPlanes[p] + (size_t) image->yuvRowBytes[p] * (begin + i)) + j;
+            }
+            job->store(&block, n, job->depth, planes[0], planes[1], planes[2]);
+
+            if (trace) {
+                t0 = platformSeconds();
+                times[2] += t0 - t2;
+            }
+        }
+    }
+
+    if (trace) {
+        traceSpan(trace, TRACE_CONVERT, start, t0);
+        traceAdd(trace, TRACE_CONVERT, 0, t0 - start);
+        traceAdd(trace, TRACE_LINEAR, 0, times[0]);
+        traceAdd(trace, TRACE_PQ, 0, times[1]);
+        traceAdd(trace, TRACE_YUV, 0, times[2]);
+    }
+}
+
+// Picks the grid cell size for one dimension in auto mode: as few cells as possible within the AV1 limit,
+// evenly sized and rounded up to a multiple of 64
+static uint32_t autoCellSize(uint32_t size, uint32_t limit) {
+    uint32_t cells = (size + limit - 1) / limit;
+    uint32_t cellSize = (size + cells - 1) / cells;
+    return min(size, (cellSize + GRID_MIN_CELL - 1) / GRID_MIN_CELL * GRID_MIN_CELL);
+}
+
+// Adds the image to the encoder, as a grid of cells if it is larger than one cell. The cells are views
+// into the planes of the image, the right column and bottom row may be smaller than the others.
+static avifResult addImage(avifEncoder *encoder, const avifImage *image, uint32_t cellWidth, uint32_t cellHeight) {
+    uint32_t gridCols = (image->width + cellWidth - 1) / cellWidth;
+    uint32_t gridRows = (image->height + cellHeight - 1) / cellHeight;
+
+    if (gridCols == 1 && gridRows == 1) {
+        return avifEncoderAddImage(encoder, image, 1, AVIF_ADD_IMAGE_FLAG_SINGLE);
+    }
+
+    uint32_t cellCount = gridCols * gridRows;
+    avifImage **cells = calloc(cellCount, sizeof(avifImage *));
+    if (cells == NULL) {
+        return AVIF_RESULT_OUT_OF_MEMORY;
+    }
+
+    avifResult result = AVIF_RESULT_OK;
+
+    for (uint32_t i = 0; i < cellCount && result == AVIF_RESULT_OK; i++) {
+        avifCropRect rect;
+        rect.x = i % gridCols * cellWidth;
+        rect.y = i / gridCols * cellHeight;
+        rect.width = min(cellWidth, image->width - rect.x);
+        rect.height = min(cellHeight, image->height - rect.y);
+
+        cells[i] = avifImageCreateEmpty();
+        if (cells[i] == NULL) {
+            result = AVIF_RESULT_OUT_OF_MEMORY;
+            break;
+        }
+
+        result = avifImageSetViewRect(cells[i], image, &rect);
+
+        // Views don't carry metadata, but the grid takes it from the cells
+        cells[i]->colorPrimaries = image->colorPrimaries;
+        cells[i]->transferCharacteristics = image->transferCharacteristics;
+        cells[i]->matrixCoefficients = image->matrixCoefficients;
+        cells[i]->clli = image->clli;
+    }
+
+    if (result == AVIF_RESULT_OK) {
+        result = avifEncoderAddImageGrid(encoder, gridCols, gridRows, (const avifImage *const *) cells,
+                                         AVIF_ADD_IMAGE_FLAG_SINGLE);
+    }
+
+    for (uint32_t i = 0; i < cellCount; i++) {
+        if (cells[i]) {
+            avifImageDestroy(cells[i]);
+        }
+    }
+    free(cells);
+
+    return result;
+}
+
+void convertOptionsInit(ConvertOptions *options) {
+    options->speed = DEFAULT_SPEED;
+    options->kernel = convertKernelBest();
+    // Without F16C, looking the halves up beats converting them
+    if (options->kernel == &convertKernelScalar) {
+        convertHalfLutInit();
+        options->toLinearHalf = convertToLinearHalfLut;
+    } else {
+        options->toLinearHalf = options->kernel->toLinearHalf;
+    }
+    options->pq = convertPqFunc(options->kernel, PQ_MODE_AUTO);
+    options->depth = DEFAULT_DEPTH;
+    options->format = CONVERT_FORMAT_YUV444;
+    options->libavifYuv = 0;
+    options->maxCllMode = MAXCLL_MODE_PERCENTILE;
+    options->bandHeight = DEFAULT_BAND_HEIGHT;
+    options->cellWidth = 0;
+    options->cellHeight = 0;
+    options->sampleStride = 1;
+    options->trace = NULL;
+}
+
+// MaxCLL/MaxPALL of a conversion, reduced from its statistics by computeLightLevels()
+typedef struct LightLevelJob {
+    LightStats *stats;
+    MaxCllMode mode;
+    ThreadPool *pool;
+    Trace *trace;
+    uint16_t maxCLL; // the value written, which may be a percentile
+    uint16_t trueMaxCLL;
+    uint16_t maxPALL;
+} LightLevelJob;
+
+// Merges the statistics into MaxCLL/MaxPALL and frees them
+static void computeLightLevels(LightLevelJob *job) {
+    LightLevels levels;
+    double start = platformSeconds();
+
+    statsMerge(job->stats, job->pool);
+    statsResult(job->stats, &levels);
+
+    job->trueMaxCLL = levels.maxCLL;
+    job->maxPALL = levels.maxPALL;
+    if (job->mode == MAXCLL_MODE_TRUE) {
+        job->maxCLL = levels.maxCLL;
+    } else {
+        job->maxCLL = (uint16_t) round(statsPercentile(job->stats, MAXCLL_PERCENTILE));
+    }
+
+    statsDestroy(job->stats);
+    job->stats = NULL;
+
+    if (job->trace) {
+        double end = platformSeconds();
+        traceSpan(job->trace, TRACE_MERGE, start, end);
+        traceAdd(job->trace, TRACE_MERGE, end - start, end - start);
+    }
+}
+
+// Thread entry of computeLightLevels(), which runs alongside the encoder
+static int LightLevelFunc(void *arg) {
+    computeLightLevels((LightLevelJob *) arg);
+    return 0;
+}
+
+static void freeThreadData(ThreadData *threads, uint32_t numThreads) {
+    for (uint32_t i = 0; i < numThreads; i++) {
+        pixelSourceDestroy(threads[i].source);
+        free(threads[i].band);
+    }
+    free(threads);
+}
+
+// Decodes the bands of a source that can't fork on a thread of its own, in order from the top, one band ahead of
+// the conversion. The band being converted and the one being decoded are the only pixels held at any time.
+typedef struct BandDecoder {
+    PixelSource *source;
+    uint8_t *buffers[2]; // band k goes into buffers[k % 2]
+    size_t stride;
+    uint32_t height; // sampled rows
+    uint32_t bandHeight;
+    uint32_t sampleStride;
+    Trace *trace;
+    Mutex mutex;
+    CondVar cond; // signaled whenever a band is decoded or converted, or on failure
+    uint32_t decoded;   // bands decoded so far
+    uint32_t converted; // bands converted so far, whose buffers can be reused
+    int failed;         // set by either side to stop the other
+} BandDecoder;
+
+static int BandDecodeFunc(void *arg) {
+    BandDecoder *d = (BandDecoder *) arg;
+
+    for (uint32_t begin = 0, k = 0; begin < d->height; begin += d->bandHeight, k++) {
+        mutexLock(&d->mutex);
+        while (!d->failed && k >= d->converted + 2) {
+            condWait(&d->cond, &d->mutex);
+        }
+        int stop = d->failed;
+        mutexUnlock(&d->mutex);
+        if (stop) {
+            break;
+        }
+
+        double start = d->trace ? platformSeconds() : 0;
+        uint32_t end = min(begin + d->bandHeight, d->height);
+        int failed = decodeRows(d->source, begin, end, d->sampleStride, d->buffers[k % 2], d->stride);
+        if (d->trace) {
+            double decoded = platformSeconds();
+            traceSpan(d->trace, TRACE_DECODE, start, decoded);
+            traceAdd(d->trace, TRACE_DECODE, 0, decoded - start);
+        }
+
+        mutexLock(&d->mutex);
+        if (failed) {
+            d->failed = 1;
+        } else {
+            d->decoded = k + 1;
+        }
+        condBroadcast(&d->cond);
+        mutexUnlock(&d->mutex);
+        if (failed) {
+            break;
+        }
+    }
+    return 0;
+}
+
+// Converts the bands of a source that can't fork while a BandDecoder decodes the next one, each band split
+// between all threads of the pool. Returns 0 on success.
+static int convertBandsInOrder(ConvertJob *job, ThreadPool *pool, uint32_t height) {
+    uint32_t numThreads = poolThreads(pool);
+
+    BandDecoder d = {0};
+    d.source = job->source;
+    d.stride = (size_t) job->width * job->bytesPerColor * 4;
+    d.height = height;
+    d.bandHeight = job->bandHeight;
+    d.sampleStride = job->sampleStride;
+    d.trace = job->trace;
+    d.buffers[0] = malloc(d.stride * d.bandHeight);
+    d.buffers[1] = malloc(d.stride * d.bandHeight);
+    if (d.buffers[0] == NULL || d.buffers[1] == NULL) {
+        fprintf(stderr, "Failed to allocate float pixels\n");
+        free(d.buffers[0]);
+        free(d.buffers[1]);
+        return 1;
+    }
+    if (mutexInit(&d.mutex) || condInit(&d.cond)) {
+        fprintf(stderr, "Failed to create mutex\n");
+        free(d.buffers[0]);
+        free(d.buffers[1]);
+        return 1;
+    }
+
+    Thread decodeThread;
+    int started = !threadCreate(&decodeThread, BandDecodeFunc, &d);
+    int failed = !started;
+    if (!started) {
+        fprintf(stderr, "Failed to create thread\n");
+    }
+
+    for (uint32_t begin = 0, k = 0; !failed && begin < height; begin += d.bandHeight, k++) {
+        mutexLock(&d.mutex);
+        while (!d.failed && d.decoded <= k) {
+            condWait(&d.cond, &d.mutex);
+        }
+        failed = d.failed;
+        mutexUnlock(&d.mutex);
+        if (failed) {
+            break;
+        }
+
+        uint32_t rows = min(d.bandHeight, height - begin);
+        job->pixels = d.buffers[k % 2];
+        job->firstRow = begin;
+        poolRun(pool, rows, (rows - 1) / numThreads + 1, convertBand, job);
+        failed = atomic_load(&job->failed);
+
+        mutexLock(&d.mutex);
+        d.converted = k + 1;
+        d.failed |= failed;
+        condBroadcast(&d.cond);
+        mutexUnlock(&d.mutex);
+    }
+
+    if (started) {
+        // On failure, the thread stops before its next band
+        threadJoin(&decodeThread);
+    }
+    condDestroy(&d.cond);
+    mutexDestroy(&d.mutex);
+    free(d.buffers[0]);
+    free(d.buffers[1]);
+    return failed;
+}
+
+// Converts the source into the YUV planes of the image on the pool and collects the statistics for
+// MaxCLL/MaxPALL. Without an image, only the statistics are collected, from every options->sampleStride-th row.
+// On success, returns 0 and sets up levels for computeLightLevels().
+static int convertPixels(const ConvertOptions *options, PixelSource *source, avifImage *image, ThreadPool *pool,
+                         LightLevelJob *levels) {
+    uint8_t bytesPerColor = source->bytesPerColor;
+    uint32_t width = source->width;
+    uint32_t sampleStride = image ? 1 : options->sampleStride;
+    uint32_t height = (source->height - 1) / sampleStride + 1; // rows actually converted
+    uint32_t numThreads = poolThreads(pool);
+
+    int returnCode = 1;
+    Trace *trace = options->trace;
+    double start = platformSeconds();
+
+    ConvertJob job;
+    job.kernel = options->kernel;
+    job.toLinearHalf = options->toLinearHalf;
+    job.pq = options->pq;
+    if (options->format == CONVERT_FORMAT_RGB) {
+        job.store = options->libavifYuv ? convertStoreGbrLibavif : convertStoreGbr;
+    } else {
+        job.store = options->libavifYuv ? convertStoreYuvLibavif : convertStoreYuv;
+    }
+    job.source = source;
+    job.pixels = NULL;
+    job.firstRow = 0;
+    job.image = image;
+    job.depth = options->depth;
+    job.width = width;
+    job.bandHeight = options->bandHeight ? options->bandHeight : (height - 1) / numThreads + 1;
+    job.sampleStride = sampleStride;
+    job.bytesPerColor = bytesPerColor;
+    job.threads = calloc(numThreads, sizeof(ThreadData));
+    job.stats = statsCreate(numThreads, options->maxCllMode == MAXCLL_MODE_TRUE ? 0 : MAXCLL_BINS_PER_NIT);
+    job.trace = trace;
+    atomic_init(&job.failed, 0);
+
+    if (job.threads == NULL || job.stats == NULL) {
+        fprintf(stderr, "Failed to allocate thread data\n");
+        goto cleanup;
+    }
+
+    // Sources that can be forked are streamed by the conversion threads, each one decoding the bands it
+    // converts. Others are decoded band by band in order, overlapped with the conversion of the band before.
+    // Either way, only a few bands of decoded pixels are held at a time.
+    if (source->fork) {
+        poolRun(pool, height, job.bandHeight, convertBand, &job);
+    } else if (convertBandsInOrder(&job, pool, height)) {
+        atomic_store(&job.failed, 1);
+    }
+
+    if (trace) {
+        traceAdd(trace, TRACE_CONVERT, platformSeconds() - start, 0);
+    }
+
+    if (atomic_load(&job.failed)) {
+        goto cleanup;
+    }
+
+    levels->stats = job.stats;
+    levels->mode = options->maxCllMode;
+    levels->pool = pool;
+    levels->trace = trace;
+    job.stats = NULL;
+
+    returnCode = 0;
+    cleanup:
+    if (job.threads) {
+        freeThreadData(job.threads, numThreads);
+    }
+    statsDestroy(job.stats);
+    return returnCode;
+}
+
+int convertSource(const ConvertOptions *options, PixelSource *source, ThreadPool *pool, int verbose,
+                  avifRWData *output, ConvertResult *result) {
+    uint32_t width = source->width;
+    uint32_t height = source->height;
+
+    int returnCode = 1;
+    avifEncoder *encoder = NULL;
+    avifRWData avifOutput = AVIF_DATA_EMPTY;
+    LightLevelJob levels = {0};
+    Thread levelThread;
+    int levelThreadStarted = 0;
+    double start = platformSeconds();
+    double convertSeconds = 0;
+
+    avifImage *image = avifImageCreate(width, height, options->depth,
+                                       AVIF_PIXEL_FORMAT_YUV444); // these values dictate what goes into the final AVIF
+    if (!image) {
+        fprintf(stderr, "Out of memory\n");
+        goto cleanup;
+    }
+    // Configure image here: (see avif/avif.h)
+    // * colorPrimaries
+    // * transferCharacteristics
+    // * matrixCoefficients
+    // * avifImageSetProfileICC()
+    // * avifImageSetMetadataExif()
+    // * avifImageSetMetadataXMP()
+    // * yuvRange
+    // * alphaPremultiplied
+    // * transforms (transformFlags, pasp, clap, irot, imir)
+    image->colorPrimaries = AVIF_COLOR_PRIMARIES_BT2020;
+    image->transferCharacteristics = AVIF_TRANSFER_CHARACTERISTICS_SMPTE2084;
+
+    image->matrixCoefficients = options->format == CONVERT_FORMAT_RGB ? AVIF_MATRIX_COEFFICIENTS_IDENTITY
+                                                                      : AVIF_MATRIX_COEFFICIENTS_BT2020_NCL;
+    image->yuvRange = AVIF_RANGE_FULL;
+
+    // The conversion threads write the YUV planes directly
+    avifResult allocateResult = avifImageAllocatePlanes(image, AVIF_PLANES_YUV);
+    if (allocateResult != AVIF_RESULT_OK) {
+        fprintf(stderr, "Failed to allocate YUV planes: %s\n", avifResultToString(allocateResult));
+        goto cleanup;
+    }
+
+    if (verbose) {
+        puts("Converting pixels to BT.2100 PQ...");
+    }
+
+    int convertFailed = convertPixels(options, source, image, pool, &levels);
+
+    pixelSourceDestroy(source);
+    source = NULL;
+
+    if (convertFailed) {
+        goto cleanup;
+    }
+    convertSeconds = platformSeconds() - start;
+
+    // The light levels are only metadata, so they are computed while the encoder runs. The encoder writes
+    // placeholders, which are patched in the output once both are done.
+    levelThreadStarted = !threadCreate(&levelThread, LightLevelFunc, &levels);
+    if (!levelThreadStarted) {
+        computeLightLevels(&levels);
+    }
+
+    if (options->maxCllMode != MAXCLL_MODE_NONE) {
+        image->clli.maxCLL = UINT16_MAX;
+        image->clli.maxPALL = UINT16_MAX;
+    }
+
+    if (verbose) {
+        printf("Doing AVIF encoding...\n");
+    }
+
+    // Created for every image: libavif can't reset an encoder once it has finished, and the creation itself only
+    // allocates it, while the codec is set up by the first image added either way
+    encoder = avifEncoderCreate();
+    if (!encoder) {
+        fprintf(stderr, "Out of memory\n");
+        goto cleanup;
+    }
+    // Configure your encoder here (see avif/avif.h):
+    // * maxThreads
+    // * quality
+    // * qualityAlpha
+    // * tileRowsLog2
+    // * tileColsLog2
+    // * speed
+    // * keyframeInterval
+    // * timescale
+    encoder->quality = AVIF_QUALITY_LOSSLESS;
+    encoder->qualityAlpha = AVIF_QUALITY_LOSSLESS;
+    encoder->speed = options->speed;
+    encoder->maxThreads = (int) poolThreads(pool);
+    encoder->autoTiling = USE_TILING;
+
+    uint32_t cellWidth = options->cellWidth;
+    uint32_t cellHeight = options->cellHeight;
+    if (cellWidth == 0) {
+        cellWidth = autoCellSize(width, GRID_MAX_WIDTH);
+        cellHeight = autoCellSize(height, GRID_MAX_HEIGHT);
+    }
+
+    cellWidth = min(cellWidth, width);
+    cellHeight = min(cellHeight, height);
+    if (verbose && (cellWidth < width || cellHeight < height)) {
+        printf("Encoding as a %ux%u grid of %ux%u cells\n", (width + cellWidth - 1) / cellWidth,
+               (height + cellHeight - 1) / cellHeight, cellWidth, cellHeight);
+    }
+
+    double encodeStart = platformSeconds();
+    double encodeCpuStart = platformCpuSeconds();
+
+    avifResult addImageResult = addImage(encoder, image, cellWidth, cellHeight);
+    if (addImageResult != AVIF_RESULT_OK) {
+        fprintf(stderr, "Failed to add image to encoder: %s\n", avifResultToString(addImageResult));
+        goto cleanup;
+    }
+
+    avifResult finishResult = avifEncoderFinish(encoder, &avifOutput);
+    if (finishResult != AVIF_RESULT_OK) {
+        fprintf(stderr, "Failed to finish encode: %s\n", avifResultToString(finishResult));
+        goto cleanup;
+    }
+
+    // The encoder's threads are invisible to the trace, so their CPU time is taken from the whole process. This
+    // includes the light level computation running alongside, which takes a tiny fraction of it.
+    if (options->trace) {
+        double encodeEnd = platformSeconds();
+        traceSpan(options->trace, TRACE_ENCODE, encodeStart, encodeEnd);
+        traceAdd(options->trace, TRACE_ENCODE, encodeEnd - encodeStart, platformCpuSeconds() - encodeCpuStart);
+    }
+
+    if (levelThreadStarted) {
+        threadJoin(&levelThread);
+        levelThreadStarted = 0;
+    }
+
+    if (options->maxCllMode != MAXCLL_MODE_NONE) {
+        if (verbose) {
+            printf("Computed HDR metadata: %u MaxCLL, %u MaxPALL\n", levels.maxCLL, levels.maxPALL);
+        }
+
+        if (!containerPatchClli(avifOutput.data, avifOutput.size, levels.maxCLL, levels.maxPALL)) {
+            fprintf(stderr, "Failed to find the clli box, the output has no HDR metadata\n");
+        }
+    }
+
+    if (verbose) {
+        printf("Encode success: %zu total bytes\n", avifOutput.size);
+    }
+
+    if (result) {
+        result->maxCLL = levels.maxCLL;
+        result->trueMaxCLL = levels.trueMaxCLL;
+        result->maxPALL = levels.maxPALL;
+        result->convertSeconds = convertSeconds;
+        result->encodeSeconds = platformSeconds() - start - convertSeconds;
+    }
+
+    *output = avifOutput;
+    avifOutput = (avifRWData) AVIF_DATA_EMPTY;
+
+    returnCode = 0;
+    cleanup:
+    if (levelThreadStarted) {
+        threadJoin(&levelThread);
+    }
+    statsDestroy(levels.stats);
+    pixelSourceDestroy(source);
+    if (image) {
+        avifImageDestroy(image);
+    }
+    if (encoder) {
+        avifEncoderDestroy(encoder);
+    }
+    avifRWDataFree(&avifOutput);
+    return returnCode;
+}
+
+int convertFile(const ConvertOptions *options, const char *inputFile, const char *outputFile, ThreadPool *pool,
+                int verbose, avifRWData *output) {
+    PixelSource *source = pixelSourceOpen(inputFile);
+
+    if (source == NULL) {
+        return 1;
+    }
+
+    avifRWData avifOutput = AVIF_DATA_EMPTY;
+    int returnCode = convertSource(options, source, pool, verbose, &avifOutput, NULL);
+    if (returnCode) {
+        return returnCode;
+    }
+
+    returnCode = 1;
+    double start = platformSeconds();
+    int toStdout = !strcmp("-", outputFile);
+    if (toStdout) {
+        platformSetBinaryMode(stdout);
+        if (fwrite(avifOutput.data, 1, avifOutput.size, stdout) != avifOutput.size || fflush(stdout)) {
+            fprintf(stderr, "Failed to write %zu bytes\n", avifOutput.size);
+            goto cleanup;
+        }
+    } else if (platformWriteFileAtomic(outputFile, avifOutput.data, avifOutput.size)) {
+        // Whatever was there before is left untouched
+        fprintf(stderr, "Failed to write %s\n", outputFile);
+        goto cleanup;
+    }
+    if (options->trace) {
+        double end = platformSeconds();
+        traceSpan(options->trace, TRACE_WRITE, start, end);
+        traceAdd(options->trace, TRACE_WRITE, end - start, end - start);
+    }
+    if (verbose && !toStdout) {
+        printf("Wrote: %s\n", outputFile);
+    }
+
+    if (output) {
+        *output = avifOutput;
+        avifOutput = (avifRWData) AVIF_DATA_EMPTY;
+    }
+
+    returnCode = 0;
+    cleanup:
+    avifRWDataFree(&avifOutput);
+    return returnCode;
+}
+
+int verifyFile(const char *inputFile, const avifRWData *avif, ThreadPool *pool, FILE *report) {
+    PixelSource *source = pixelSourceOpen(inputFile);
+
+    if (source == NULL) {
+        return 1;
+    }
+
+    VerifyResult result;
+    int returnCode = verifyOutput(avif, source, pool, &result);
+    pixelSourceDestroy(source);
+
+    if (returnCode == 0) {
+        returnCode = result.visiblePixels != 0;
+        fprintf(report, "Verified %s: max error %.2f code values, Delta E ITP mean %.3f, max %.3f, %llu pixels above 1: %s\n",
+               inputFile, result.maxCodeError, result.meanDeltaE, result.maxDeltaE,
+               (unsigned long long) result.visiblePixels, returnCode ? "FAILED" : "ok");
+    }
+    return returnCode;
+}
+
+int analyzeSource(const ConvertOptions *options, PixelSource *source, ThreadPool *pool, ConvertResult *result) {
+    LightLevelJob levels;
+    double start = platformSeconds();
+
+    if (convertPixels(options, source, NULL, pool, &levels)) {
+        return 1;
+    }
+    computeLightLevels(&levels);
+
+    result->maxCLL = levels.maxCLL;
+    result->trueMaxCLL = levels.trueMaxCLL;
+    result->maxPALL = levels.maxPALL;
+    result->convertSeconds = platformSeconds() - start;
+    result->encodeSeconds = 0;
+    return 0;
+}
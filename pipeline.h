@@ -0,0 +1,76 @@
+#ifndef JXR_TO_AVIF_PIPELINE_H
+#define JXR_TO_AVIF_PIPELINE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "avif.h"
+#include "convert.h"
+#include "pixel_source.h"
+#include "pool.h"
+#include "trace.h"
+
+#define GRID_MIN_CELL 64  // MIAF minimum for grid cells
+
+typedef enum ConvertFormat {
+    CONVERT_FORMAT_YUV444, // BT.2020 non-constant luminance
+    CONVERT_FORMAT_RGB,    // identity matrix, lossless but a much larger file
+} ConvertFormat;
+
+// The MaxCLL written to the file
+typedef enum MaxCllMode {
+    MAXCLL_MODE_PERCENTILE, // light level of the 99.99 percentile brightest pixel, see the README
+    MAXCLL_MODE_TRUE,       // brightest pixel, as defined by H.274
+    MAXCLL_MODE_NONE,       // no clli box at all
+} MaxCllMode;
+
+typedef struct ConvertOptions {
+    int speed;
+    const ConvertKernel *kernel;
+    void (*toLinearHalf)(const _Float16 *src, uint32_t start, uint32_t n, ConvertBlock *block);
+    void (*pq)(float *v, uint32_t n);
+    uint32_t depth; // 10 or 12
+    ConvertFormat format;
+    int libavifYuv; // round to 16-bit RGB first and convert exactly like avifImageRGBToYUV, at some cost in speed
+    MaxCllMode maxCllMode;
+    uint32_t bandHeight;
+    uint32_t cellWidth; // 0 for auto, UINT32_MAX for off
+    uint32_t cellHeight;
+    uint32_t sampleStride; // rows between the ones analyzed by analyzeSource()
+    Trace *trace; // receives the time spent in every stage if not NULL
+} ConvertOptions;
+
+// What a conversion measured, light levels in nits
+typedef struct ConvertResult {
+    uint16_t maxCLL; // the value written, which may be a percentile
+    uint16_t trueMaxCLL;
+    uint16_t maxPALL;
+    double convertSeconds; // decoding and conversion to YUV, on the pool
+    double encodeSeconds;  // AV1 encoding and writing the container into memory
+} ConvertResult;
+
+// Sets the defaults of the command line: the fastest kernel with its own PQ, fused conversion to 12-bit YUV 4:4:4
+// with percentile MaxCLL, default speed, band height and grid
+void convertOptionsInit(ConvertOptions *options);
+
+// Converts the source to an AVIF file in memory, using the threads of the pool for conversion and as many for
+// encoding. The source is destroyed as soon as its pixels are converted, so the decoder's memory is freed
+// before the encode. Progress messages are only printed if verbose is set, errors always are. result may be
+// NULL. Returns 0 on success, in which case output must be freed with avifRWDataFree().
+int convertSource(const ConvertOptions *options, PixelSource *source, ThreadPool *pool, int verbose,
+                  avifRWData *output, ConvertResult *result);
+
+// convertSource() from and to files, where "-" is standard input or output. If output is not NULL, the encoded file
+// is also returned in it, to be freed with avifRWDataFree(). Returns 0 on success.
+int convertFile(const ConvertOptions *options, const char *inputFile, const char *outputFile, ThreadPool *pool,
+                int verbose, avifRWData *output);
+
+// Decodes an output of convertFile() and compares it with its input with verifyOutput() on the pool, printing
+// the result to report. Returns 0 if no pixel differs visibly from the input.
+int verifyFile(const char *inputFile, const avifRWData *avif, ThreadPool *pool, FILE *report);
+
+// Computes only the light levels, from every options->sampleStride-th row, without PQ conversion or encoding.
+// Returns 0 on success.
+int analyzeSource(const ConvertOptions *options, PixelSource *source, ThreadPool *pool, ConvertResult *result);
+
+#endif // JXR_TO_AVIF_PIPELINE_H
@@ -0,0 +1,252 @@
+#include "pixel_source.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+
+#define STDIN_CHUNK (1 << 24)  // initial size of the buffer for standard input, which doubles as needed
+
+// Standard input can only be read once, so it is kept for every source opened from it
+static uint8_t *stdinData;
+static size_t stdinSize;
+
+// Reads all of standard input into stdinData. Returns 0 on success.
+static int readStdin(void) {
+    platformSetBinaryMode(stdin);
+
+    size_t capacity = 0;
+    size_t size = 0;
+    uint8_t *data = NULL;
+    while (1) {
+        if (size == capacity) {
+            capacity = capacity ? capacity * 2 : STDIN_CHUNK;
+            uint8_t *grown = realloc(data, capacity);
+            if (grown == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                free(data);
+                return 1;
+            }
+            data = grown;
+        }
+        size_t n = fread(data + size, 1, capacity - size, stdin);
+        size += n;
+        if (n == 0) {
+            break;
+        }
+    }
+    if (ferror(stdin)) {
+        fprintf(stderr, "Failed to read standard input\n");
+        free(data);
+        return 1;
+    }
+
+    stdinData = data;
+    stdinSize = size;
+    return 0;
+}
+
+static int isPfm(const uint8_t *data, size_t size) {
+    return size >= 2 && data[0] == 'P' && (data[1] == 'F' || data[1] == 'f' || data[1] == 'H' || data[1] == 'h');
+}
+
+// A mapped input file, shared by the source opened from it and all of its forks
+typedef struct SharedMapping {
+    MappedFile file;
+    atomic_int references;
+} SharedMapping;
+
+// Wraps a source that reads from a mapping, which is unmapped once the last fork is destroyed
+typedef struct MappedPixelSource {
+    PixelSource base;
+    PixelSource *inner;
+    SharedMapping *mapping;
+} MappedPixelSource;
+
+static PixelSource *wrapMapped(PixelSource *inner, SharedMapping *mapping);
+
+static void releaseMapping(SharedMapping *mapping) {
+    if (atomic_fetch_sub(&mapping->references, 1) == 1) {
+        platformUnmapFile(&mapping->file);
+        free(mapping);
+    }
+}
+
+// Every read of the mapping goes through platformGuardMapped(), so that a file truncated by another process
+// fails the conversion instead of killing the process
+typedef struct MappedCall {
+    PixelSource *source;
+    const uint8_t *data;
+    size_t size;
+    uint32_t y;
+    uint32_t rows;
+    uint8_t *dst;
+    size_t stride;
+    PixelSource *result;
+} MappedCall;
+
+static int copyRowsCall(void *arg) {
+    MappedCall *call = (MappedCall *) arg;
+    return call->source->copyRows(call->source, call->y, call->rows, call->dst, call->stride);
+}
+
+static int forkCall(void *arg) {
+    MappedCall *call = (MappedCall *) arg;
+    call->result = call->source->fork(call->source);
+    return 0;
+}
+
+static int openBufferCall(void *arg) {
+    MappedCall *call = (MappedCall *) arg;
+    call->result = pixelSourceOpenBuffer(call->data, call->size);
+    return 0;
+}
+
+static void reportChangedFile(void) {
+    fprintf(stderr, "Input file was truncated while decoding\n");
+}
+
+static int mappedCopyRows(PixelSource *source, uint32_t y, uint32_t rows, uint8_t *dst, size_t stride) {
+    MappedPixelSource *mapped = (MappedPixelSource *) source;
+    MappedCall call = {.source = mapped->inner, .y = y, .rows = rows, .dst = dst, .stride = stride};
+    int result = platformGuardMapped(copyRowsCall, &call);
+    if (result < 0) {
+        reportChangedFile();
+    }
+    return result;
+}
+
+static PixelSource *mappedFork(PixelSource *source) {
+    MappedPixelSource *mapped = (MappedPixelSource *) source;
+    MappedCall call = {.source = mapped->inner};
+    if (platformGuardMapped(forkCall, &call)) {
+        // Whatever the fork allocated before the fault is lost, which only happens once per conversion
+        reportChangedFile();
+        return NULL;
+    }
+    PixelSource *fork = call.result;
+    if (fork == NULL) {
+        return NULL;
+    }
+    atomic_fetch_add(&mapped->mapping->references, 1);
+    return wrapMapped(fork, mapped->mapping);
+}
+
+static void mappedDestroy(PixelSource *source) {
+    MappedPixelSource *mapped = (MappedPixelSource *) source;
+    pixelSourceDestroy(mapped->inner);
+    releaseMapping(mapped->mapping);
+    free(mapped);
+}
+
+// Takes over inner and a reference to the mapping, releasing both on failure
+static PixelSource *wrapMapped(PixelSource *inner, SharedMapping *mapping) {
+    MappedPixelSource *mapped = calloc(1, sizeof(MappedPixelSource));
+    if (mapped == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        pixelSourceDestroy(inner);
+        releaseMapping(mapping);
+        return NULL;
+    }
+    mapped->base.width = inner->width;
+    mapped->base.height = inner->height;
+    mapped->base.bytesPerColor = inner->bytesPerColor;
+    mapped->base.copyRows = mappedCopyRows;
+    mapped->base.fork = inner->fork ? mappedFork : NULL;
+    mapped->base.destroy = mappedDestroy;
+    mapped->inner = inner;
+    mapped->mapping = mapping;
+    return &mapped->base;
+}
+
+// Opens the file through a memory mapping, which saves reading it through stdio, and lets the forks of the
+// source share the mapping instead of opening the file again. Returns 1 if the file can't be mapped, such as a
+// pipe, otherwise 0 and the source, which is NULL if it failed to open.
+static int openMapped(const char *path, PixelSource **source) {
+    SharedMapping *mapping = malloc(sizeof(SharedMapping));
+    if (mapping == NULL || platformMapFile(path, &mapping->file)) {
+        free(mapping);
+        return 1;
+    }
+#ifdef _WIN32
+    // WIC streams over memory are limited to 32-bit sizes. The file can't change on Windows, so reading its
+    // magic needs no guard.
+    if (mapping->file.size > UINT32_MAX && !isPfm(mapping->file.data, mapping->file.size)) {
+        platformUnmapFile(&mapping->file);
+        free(mapping);
+        return 1;
+    }
+#endif
+    atomic_init(&mapping->references, 1);
+
+    MappedCall call = {.data = mapping->file.data, .size = mapping->file.size};
+    PixelSource *inner = NULL;
+    if (platformGuardMapped(openBufferCall, &call)) {
+        reportChangedFile();
+    } else {
+        inner = call.result;
+    }
+    if (inner == NULL) {
+        releaseMapping(mapping);
+        *source = NULL;
+        return 0;
+    }
+    *source = wrapMapped(inner, mapping);
+    return 0;
+}
+
+PixelSource *pixelSourceOpen(const char *path) {
+    if (!strcmp("-", path)) {
+        if (stdinData == NULL && readStdin()) {
+            return NULL;
+        }
+        return pixelSourceOpenBuffer(stdinData, stdinSize);
+    }
+
+    PixelSource *source;
+    if (!openMapped(path, &source)) {
+        return source;
+    }
+
+    FILE *f = platformFopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to open file\n");
+        return NULL;
+    }
+
+    uint8_t magic[2] = {0};
+    size_t magicSize = fread(magic, 1, sizeof(magic), f);
+    fclose(f);
+
+    if (isPfm(magic, magicSize)) {
+        return pixelSourceOpenPfm(path);
+    }
+
+#ifdef _WIN32
+    return pixelSourceOpenWic(path);
+#else
+    fprintf(stderr, "Unsupported input format, only PFM-style dumps can be read without WIC\n");
+    return NULL;
+#endif
+}
+
+PixelSource *pixelSourceOpenBuffer(const uint8_t *data, size_t size) {
+    if (isPfm(data, size)) {
+        return pixelSourceOpenPfmBuffer(data, size);
+    }
+
+#ifdef _WIN32
+    return pixelSourceOpenWicBuffer(data, size);
+#else
+    fprintf(stderr, "Unsupported input format, only PFM-style dumps can be read without WIC\n");
+    return NULL;
+#endif
+}
+
+void pixelSourceDestroy(PixelSource *source) {
+    if (source) {
+        source->destroy(source);
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef JXR_TO_AVIF_PIXEL_SOURCE_H
+#define JXR_TO_AVIF_PIXEL_SOURCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A decoded scRGB image that hands out rows of RGBA pixels, either as 128bppRGBAFloat
+// (bytesPerColor == 4) or as 64bppRGBAHalf (bytesPerColor == 2). Backends embed this struct as
+// their first member.
+typedef struct PixelSource {
+    uint32_t width;
+    uint32_t height;
+    uint8_t bytesPerColor;
+
+    // Copies rows [y, y + rows) into dst, with consecutive rows stride bytes apart. Returns 0 on success.
+    int (*copyRows)(struct PixelSource *source, uint32_t y, uint32_t rows, uint8_t *dst, size_t stride);
+    // Optional. Opens an independent decoder for the same image, for use on another thread, so that
+    // several threads can decode disjoint rows at the same time. Returns NULL on failure.
+    struct PixelSource *(*fork)(struct PixelSource *source);
+    void (*destroy)(struct PixelSource *source);
+} PixelSource;
+
+// Opens an image, picking the backend from the file contents. Prints an error and returns NULL on failure. "-" reads
+// standard input, which is kept in memory until the process exits, so that it can be opened again.
+PixelSource *pixelSourceOpen(const char *path);
+// Opens an image file that is already in memory. The data is borrowed, not copied, and must outlive the source
+// and its forks.
+PixelSource *pixelSourceOpenBuffer(const uint8_t *data, size_t size);
+void pixelSourceDestroy(PixelSource *source);
+
+// Decodes JPEG XR (or anything else WIC understands) through the Windows Imaging Component
+PixelSource *pixelSourceOpenWic(const char *path);
+PixelSource *pixelSourceOpenWicBuffer(const uint8_t *data, size_t size);
+
+// Reads PFM-style dumps: "PF"/"Pf" for RGB/grayscale float32 (the regular PFM format), and "PH"/"Ph"
+// for the same layout with float16 samples. Rows are stored bottom to top and a negative scale
+// marks little-endian samples, as in PFM.
+PixelSource *pixelSourceOpenPfm(const char *path);
+PixelSource *pixelSourceOpenPfmBuffer(const uint8_t *data, size_t size);
+
+// Wraps RGBA pixels that are already in memory, with consecutive rows stride bytes apart. The pixels are
+// borrowed, not copied, and must outlive the source and its forks.
+PixelSource *pixelSourceOpenMemory(const uint8_t *pixels, uint32_t width, uint32_t height, uint8_t bytesPerColor,
+                                   size_t stride);
+
+#endif // JXR_TO_AVIF_PIXEL_SOURCE_H
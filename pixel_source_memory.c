@@ -0,0 +1,50 @@
+#include "pixel_source.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct MemoryPixelSource {
+    PixelSource base;
+    const uint8_t *pixels;
+    size_t stride;
+} MemoryPixelSource;
+
+static int memoryCopyRows(PixelSource *source, uint32_t y, uint32_t rows, uint8_t *dst, size_t stride) {
+    MemoryPixelSource *memory = (MemoryPixelSource *) source;
+    size_t rowSize = (size_t) source->width * source->bytesPerColor * 4;
+
+    for (uint32_t i = 0; i < rows; i++) {
+        memcpy(dst + i * stride, memory->pixels + (y + i) * memory->stride, rowSize);
+    }
+    return 0;
+}
+
+// Copying rows out of memory needs no state, so every thread can share the pixels
+static PixelSource *memoryFork(PixelSource *source) {
+    MemoryPixelSource *memory = (MemoryPixelSource *) source;
+    return pixelSourceOpenMemory(memory->pixels, source->width, source->height, source->bytesPerColor,
+                                 memory->stride);
+}
+
+static void memoryDestroy(PixelSource *source) {
+    free(source);
+}
+
+PixelSource *pixelSourceOpenMemory(const uint8_t *pixels, uint32_t width, uint32_t height, uint8_t bytesPerColor,
+                                   size_t stride) {
+    MemoryPixelSource *memory = calloc(1, sizeof(MemoryPixelSource));
+    if (memory == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return NULL;
+    }
+    memory->base.width = width;
+    memory->base.height = height;
+    memory->base.bytesPerColor = bytesPerColor;
+    memory->base.copyRows = memoryCopyRows;
+    memory->base.fork = memoryFork;
+    memory->base.destroy = memoryDestroy;
+    memory->pixels = pixels;
+    memory->stride = stride;
+    return &memory->base;
+}
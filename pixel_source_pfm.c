@@ -0,0 +1,222 @@
+#include "pixel_source.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+
+#define PFM_MAX_HEADER 256  // generous, the header is usually 20 bytes or less
+
+typedef struct PfmPixelSource {
+    PixelSource base;
+    char *path;
+    FILE *f;
+    const uint8_t *data; // the whole file if it is in memory, instead of path and f
+    size_t size;
+    int64_t dataOffset;
+    uint8_t channels;
+    uint8_t swapBytes; // samples are stored in the opposite byte order of the host
+    uint8_t *row; // one file row, before expansion to RGBA
+} PfmPixelSource;
+
+static void byteSwapRow(uint8_t *row, size_t samples, uint8_t bytesPerColor) {
+    for (size_t i = 0; i < samples; i++) {
+        uint8_t *s = row + i * bytesPerColor;
+        for (int k = 0; k < bytesPerColor / 2; k++) {
+            uint8_t t = s[k];
+            s[k] = s[bytesPerColor - 1 - k];
+            s[bytesPerColor - 1 - k] = t;
+        }
+    }
+}
+
+static int pfmCopyRows(PixelSource *source, uint32_t y, uint32_t rows, uint8_t *dst, size_t stride) {
+    PfmPixelSource *pfm = (PfmPixelSource *) source;
+    uint32_t width = source->width;
+    uint8_t bytesPerColor = source->bytesPerColor;
+    size_t fileRowSize = (size_t) width * pfm->channels * bytesPerColor;
+
+    for (uint32_t i = 0; i < rows; i++) {
+        // PFM stores the bottom row first
+        uint32_t fileRow = source->height - 1 - (y + i);
+        int64_t offset = pfm->dataOffset + (int64_t) fileRow * (int64_t) fileRowSize;
+        if (pfm->data) {
+            memcpy(pfm->row, pfm->data + offset, fileRowSize);
+        } else if (platformFseek64(pfm->f, offset, SEEK_SET) || fread(pfm->row, 1, fileRowSize, pfm->f) != fileRowSize) {
+            fprintf(stderr, "Failed to read pixels\n");
+            return 1;
+        }
+
+        if (pfm->swapBytes) {
+            byteSwapRow(pfm->row, (size_t) width * pfm->channels, bytesPerColor);
+        }
+
+        uint8_t *out = dst + i * stride;
+        if (bytesPerColor == 4) {
+            const float *in = (const float *) pfm->row;
+            float *outF = (float *) out;
+            for (uint32_t j = 0; j < width; j++) {
+                for (int k = 0; k < 3; k++) {
+                    outF[4 * j + k] = in[pfm->channels * j + (pfm->channels == 3 ? k : 0)];
+                }
+                outF[4 * j + 3] = 1.0f;
+            }
+        } else {
+            const _Float16 *in = (const _Float16 *) pfm->row;
+            _Float16 *outH = (_Float16 *) out;
+            for (uint32_t j = 0; j < width; j++) {
+                for (int k = 0; k < 3; k++) {
+                    outH[4 * j + k] = in[pfm->channels * j + (pfm->channels == 3 ? k : 0)];
+                }
+                outH[4 * j + 3] = (_Float16) 1.0f;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static PixelSource *pfmFork(PixelSource *source) {
+    PfmPixelSource *pfm = (PfmPixelSource *) source;
+    if (pfm->data) {
+        return pixelSourceOpenPfmBuffer(pfm->data, pfm->size);
+    }
+    return pixelSourceOpenPfm(pfm->path);
+}
+
+static void pfmDestroy(PixelSource *source) {
+    PfmPixelSource *pfm = (PfmPixelSource *) source;
+    if (pfm->f) {
+        fclose(pfm->f);
+    }
+    free(pfm->row);
+    free(pfm->path);
+    free(pfm);
+}
+
+static PfmPixelSource *pfmCreate(void) {
+    PfmPixelSource *pfm = calloc(1, sizeof(PfmPixelSource));
+    if (pfm == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return NULL;
+    }
+    pfm->base.copyRows = pfmCopyRows;
+    pfm->base.fork = pfmFork;
+    pfm->base.destroy = pfmDestroy;
+    return pfm;
+}
+
+// Parses the header at the start of the file, of which size bytes are available, and sets up the source for
+// the raster that follows. Returns 0 on success.
+static int pfmParseHeader(PfmPixelSource *pfm, const uint8_t *data, size_t size) {
+    char header[PFM_MAX_HEADER + 1];
+    size = min(size, PFM_MAX_HEADER);
+    memcpy(header, data, size);
+    header[size] = 0;
+
+    char magic[3] = {0};
+    uint32_t width, height;
+    float scale;
+    int headerSize = 0;
+    // A single whitespace character separates the header from the raster
+    if (sscanf(header, "%2s %u %u %f%n", magic, &width, &height, &scale, &headerSize) != 4 ||
+        (size_t) headerSize >= size) {
+        fprintf(stderr, "Failed to parse PFM header\n");
+        return 1;
+    }
+
+    if (!strcmp(magic, "PF")) {
+        pfm->channels = 3;
+        pfm->base.bytesPerColor = 4;
+    } else if (!strcmp(magic, "Pf")) {
+        pfm->channels = 1;
+        pfm->base.bytesPerColor = 4;
+    } else if (!strcmp(magic, "PH")) {
+        pfm->channels = 3;
+        pfm->base.bytesPerColor = 2;
+    } else if (!strcmp(magic, "Ph")) {
+        pfm->channels = 1;
+        pfm->base.bytesPerColor = 2;
+    } else {
+        fprintf(stderr, "Unsupported pixel format\n");
+        return 1;
+    }
+
+    if (width == 0 || height == 0) {
+        fprintf(stderr, "Invalid image size\n");
+        return 1;
+    }
+
+    pfm->base.width = width;
+    pfm->base.height = height;
+    pfm->dataOffset = headerSize + 1;
+
+    // Samples are little-endian if the scale is negative
+    uint16_t one = 1;
+    uint8_t hostLittleEndian = *(uint8_t *) &one;
+    pfm->swapBytes = (scale < 0) != hostLittleEndian;
+
+    pfm->row = malloc((size_t) width * pfm->channels * pfm->base.bytesPerColor);
+    if (pfm->row == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    return 0;
+}
+
+PixelSource *pixelSourceOpenPfm(const char *path) {
+    PfmPixelSource *pfm = pfmCreate();
+    if (pfm == NULL) {
+        return NULL;
+    }
+
+    pfm->path = strdup(path);
+    if (pfm->path == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        goto fail;
+    }
+
+    pfm->f = platformFopen(path, "rb");
+    if (pfm->f == NULL) {
+        fprintf(stderr, "Failed to open file\n");
+        goto fail;
+    }
+
+    uint8_t header[PFM_MAX_HEADER];
+    size_t headerSize = fread(header, 1, sizeof(header), pfm->f);
+    if (pfmParseHeader(pfm, header, headerSize)) {
+        goto fail;
+    }
+
+    return &pfm->base;
+
+    fail:
+    pfmDestroy(&pfm->base);
+    return NULL;
+}
+
+PixelSource *pixelSourceOpenPfmBuffer(const uint8_t *data, size_t size) {
+    PfmPixelSource *pfm = pfmCreate();
+    if (pfm == NULL) {
+        return NULL;
+    }
+    pfm->data = data;
+    pfm->size = size;
+
+    if (pfmParseHeader(pfm, data, size)) {
+        goto fail;
+    }
+
+    size_t rasterSize = (size_t) pfm->base.width * pfm->base.height * pfm->channels * pfm->base.bytesPerColor;
+    if (rasterSize > size - pfm->dataOffset) {
+        fprintf(stderr, "PFM data is truncated\n");
+        goto fail;
+    }
+
+    return &pfm->base;
+
+    fail:
+    pfmDestroy(&pfm->base);
+    return NULL;
+}
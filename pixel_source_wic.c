@@ -0,0 +1,202 @@
+// CoIncrementMTAUsage() needs Windows 8
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0602
+#endif
+
+#include "pixel_source.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <windows.h>
+#include <wincodec.h>
+
+#include "platform.h"
+
+typedef struct WicPixelSource {
+    PixelSource base;
+    IWICImagingFactory *pFactory;
+    IWICBitmapDecoder *pDecoder;
+    IWICBitmapFrameDecode *pFrame;
+    IWICBitmapSource *pBitmapSource;
+    IWICStream *pStream;
+} WicPixelSource;
+
+// The imaging factory is free-threaded, so one is created for the whole process on first use and shared by
+// every decoder, including those of later files. Like the factory, the multithreaded apartment is kept for the
+// whole process, so any thread can use the decoders without initializing COM itself.
+static INIT_ONCE factoryOnce = INIT_ONCE_STATIC_INIT;
+static IWICImagingFactory *sharedFactory;
+
+static BOOL CALLBACK createFactory(PINIT_ONCE once, PVOID parameter, PVOID *context) {
+    static CO_MTA_USAGE_COOKIE mtaCookie;
+    if (mtaCookie == NULL && FAILED(CoIncrementMTAUsage(&mtaCookie))) {
+        return FALSE;
+    }
+
+    HRESULT hr = CoCreateInstance(
+            &CLSID_WICImagingFactory,
+            NULL,
+            CLSCTX_INPROC_SERVER,
+            &IID_IWICImagingFactory,
+            (void **) &sharedFactory);
+    return SUCCEEDED(hr); // on failure, the next call tries again
+}
+
+static int wicCopyRows(PixelSource *source, uint32_t y, uint32_t rows, uint8_t *dst, size_t stride) {
+    WicPixelSource *wic = (WicPixelSource *) source;
+
+    WICRect rc;
+    rc.Y = (int) y;
+    rc.X = 0;
+    rc.Width = (int) source->width;
+    rc.Height = (int) rows;
+    HRESULT hr = wic->pBitmapSource->lpVtbl->CopyPixels(wic->pBitmapSource,
+                                                        &rc,
+                                                        (UINT) stride,
+                                                        (UINT) (stride * rows),
+                                                        dst);
+
+    if (FAILED(hr)) {
+        fprintf(stderr, "Failed to copy pixels\n");
+        return 1;
+    }
+    return 0;
+}
+
+static void wicDestroy(PixelSource *source) {
+    WicPixelSource *wic = (WicPixelSource *) source;
+    if (wic->pBitmapSource) {
+        wic->pBitmapSource->lpVtbl->Release(wic->pBitmapSource);
+    }
+    if (wic->pFrame) {
+        wic->pFrame->lpVtbl->Release(wic->pFrame);
+    }
+    if (wic->pDecoder) {
+        wic->pDecoder->lpVtbl->Release(wic->pDecoder);
+    }
+    if (wic->pStream) {
+        wic->pStream->lpVtbl->Release(wic->pStream);
+    }
+    if (wic->pFactory) {
+        wic->pFactory->lpVtbl->Release(wic->pFactory);
+    }
+    free(wic);
+}
+
+// Opens the file at path, or the one in memory if data is not NULL
+static PixelSource *wicOpen(const wchar_t *path, const uint8_t *data, size_t size) {
+    WicPixelSource *wic = calloc(1, sizeof(WicPixelSource));
+    if (wic == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return NULL;
+    }
+    // No fork, so the pipeline decodes the bands in order through this one decoder, overlapped with the
+    // conversion. Whether decoders on several threads would be faster is yet to be measured on Windows.
+    wic->base.copyRows = wicCopyRows;
+    wic->base.destroy = wicDestroy;
+
+    if (!InitOnceExecuteOnce(&factoryOnce, createFactory, NULL, NULL)) {
+        fprintf(stderr, "Failed to create WIC imaging factory\n");
+        goto fail;
+    }
+    wic->pFactory = sharedFactory;
+    wic->pFactory->lpVtbl->AddRef(wic->pFactory);
+
+    HRESULT hr;
+    if (data) {
+        hr = wic->pFactory->lpVtbl->CreateStream(wic->pFactory, &wic->pStream);
+        if (SUCCEEDED(hr)) {
+            hr = wic->pStream->lpVtbl->InitializeFromMemory(wic->pStream, (BYTE *) data, (DWORD) size);
+        }
+        if (SUCCEEDED(hr)) {
+            hr = wic->pFactory->lpVtbl->CreateDecoderFromStream(
+                    wic->pFactory,
+                    (IStream *) wic->pStream,        // Image to be decoded
+                    NULL,                            // Do not prefer a particular vendor
+                    WICDecodeMetadataCacheOnDemand,  // Cache metadata when needed
+                    &wic->pDecoder                   // Pointer to the decoder
+            );
+        }
+    } else {
+        hr = wic->pFactory->lpVtbl->CreateDecoderFromFilename(
+                wic->pFactory,
+                path,                            // Image to be decoded
+                NULL,                            // Do not prefer a particular vendor
+                GENERIC_READ,                    // Desired read access to the file
+                WICDecodeMetadataCacheOnDemand,  // Cache metadata when needed
+                &wic->pDecoder                   // Pointer to the decoder
+        );
+    }
+
+    if (FAILED(hr)) {
+        fprintf(stderr, "Failed to open file\n");
+        goto fail;
+    }
+
+    // Retrieve the first frame of the image from the decoder
+    hr = wic->pDecoder->lpVtbl->GetFrame(wic->pDecoder, 0, &wic->pFrame);
+
+    if (FAILED(hr)) {
+        fprintf(stderr, "Failed to get frame\n");
+        goto fail;
+    }
+
+    hr = wic->pFrame->lpVtbl->QueryInterface(wic->pFrame, &IID_IWICBitmapSource, (void **) &wic->pBitmapSource);
+
+    if (FAILED(hr)) {
+        fprintf(stderr, "Failed to get IWICBitmapSource\n");
+        goto fail;
+    }
+
+    WICPixelFormatGUID pixelFormat;
+
+    hr = wic->pBitmapSource->lpVtbl->GetPixelFormat(wic->pBitmapSource, &pixelFormat);
+
+    if (FAILED(hr)) {
+        fprintf(stderr, "Failed to get pixel format\n");
+        goto fail;
+    }
+
+    if (IsEqualGUID((void *) &pixelFormat, (void *) &GUID_WICPixelFormat128bppRGBAFloat)) {
+        wic->base.bytesPerColor = 4;
+    } else if (IsEqualGUID((void *) &pixelFormat, (void *) &GUID_WICPixelFormat64bppRGBAHalf)) {
+        wic->base.bytesPerColor = 2;
+    } else {
+        fprintf(stderr, "Unsupported pixel format\n");
+        goto fail;
+    }
+
+    hr = wic->pBitmapSource->lpVtbl->GetSize(wic->pBitmapSource, &wic->base.width, &wic->base.height);
+
+    if (FAILED(hr)) {
+        fprintf(stderr, "Failed to get size\n");
+        goto fail;
+    }
+
+    return &wic->base;
+
+    fail:
+    wicDestroy(&wic->base);
+    return NULL;
+}
+
+PixelSource *pixelSourceOpenWic(const char *path) {
+    wchar_t *widePath = platformWidenString(path);
+    if (widePath == NULL) {
+        fprintf(stderr, "Failed to convert file name\n");
+        return NULL;
+    }
+
+    PixelSource *source = wicOpen(widePath, NULL, 0);
+    free(widePath);
+    return source;
+}
+
+PixelSource *pixelSourceOpenWicBuffer(const uint8_t *data, size_t size) {
+    // WIC streams over memory are limited to 32-bit sizes
+    if (size > UINT32_MAX) {
+        fprintf(stderr, "Input is too large\n");
+        return NULL;
+    }
+    return wicOpen(NULL, data, size);
+}
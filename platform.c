@@ -0,0 +1,812 @@
+#include "platform.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <shellapi.h>
+#include <psapi.h>
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#endif
+
+#define WRITE_CHUNK (1 << 30)  // largest single write, as Windows takes a DWORD
+
+// Distinguishes the temporary files of concurrent writes of one process
+static atomic_uint temporaryCounter;
+
+// Returns path with a suffix that is unique to this process and call, free() the result
+static char *temporaryPath(const char *path, unsigned long pid) {
+    size_t size = strlen(path) + 32;
+    char *temporary = malloc(size);
+    if (temporary != NULL) {
+        snprintf(temporary, size, "%s.%lu.%u.tmp", path, pid, atomic_fetch_add(&temporaryCounter, 1));
+    }
+    return temporary;
+}
+
+// Appends dir + separator + name to the array, growing it as needed. Returns 0 on success.
+static int appendPath(char ***paths, int *count, int *capacity, const char *dir, const char *name, char separator) {
+    if (*count == *capacity) {
+        int newCapacity = *capacity ? *capacity * 2 : 16;
+        char **grown = realloc(*paths, sizeof(char *) * newCapacity);
+        if (grown == NULL) {
+            return 1;
+        }
+        *paths = grown;
+        *capacity = newCapacity;
+    }
+
+    size_t dirLength = strlen(dir);
+    int needsSeparator = dirLength > 0 && dir[dirLength - 1] != '/' && dir[dirLength - 1] != separator;
+    char *path = malloc(dirLength + needsSeparator + strlen(name) + 1);
+    if (path == NULL) {
+        return 1;
+    }
+    strcpy(path, dir);
+    if (needsSeparator) {
+        path[dirLength] = separator;
+        path[dirLength + 1] = '\0';
+    }
+    strcat(path, name);
+
+    (*paths)[(*count)++] = path;
+    return 0;
+}
+
+static void freePaths(char **paths, int count) {
+    for (int i = 0; i < count; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+}
+
+#ifdef _WIN32
+
+static DWORD WINAPI threadTrampoline(LPVOID lpParam) {
+    Thread *thread = (Thread *) lpParam;
+    return (DWORD) thread->proc(thread->arg);
+}
+
+int threadCreate(Thread *thread, ThreadProc proc, void *arg) {
+    thread->proc = proc;
+    thread->arg = arg;
+    thread->exitCode = 0;
+    thread->handle = CreateThread(
+            NULL,                   // default security attributes
+            0,                      // use default stack size
+            threadTrampoline,       // thread function name
+            thread,                 // argument to thread function
+            0,                      // use default creation flags
+            NULL);                  // don't need the thread identifier
+    return thread->handle ? 0 : 1;
+}
+
+int threadJoin(Thread *thread) {
+    if (WaitForSingleObject(thread->handle, INFINITE) != WAIT_OBJECT_0) {
+        return -1;
+    }
+    DWORD exitCode;
+    if (!GetExitCodeThread(thread->handle, &exitCode)) {
+        exitCode = (DWORD) -1;
+    }
+    CloseHandle(thread->handle);
+    thread->exitCode = (int) exitCode;
+    return thread->exitCode;
+}
+
+int mutexInit(Mutex *mutex) {
+    InitializeSRWLock(&mutex->lock);
+    return 0;
+}
+
+void mutexDestroy(Mutex *mutex) {
+    (void) mutex;
+}
+
+void mutexLock(Mutex *mutex) {
+    AcquireSRWLockExclusive(&mutex->lock);
+}
+
+void mutexUnlock(Mutex *mutex) {
+    ReleaseSRWLockExclusive(&mutex->lock);
+}
+
+int condInit(CondVar *cond) {
+    InitializeConditionVariable(&cond->cond);
+    return 0;
+}
+
+void condDestroy(CondVar *cond) {
+    (void) cond;
+}
+
+void condWait(CondVar *cond, Mutex *mutex) {
+    SleepConditionVariableSRW(&cond->cond, &mutex->lock, INFINITE, 0);
+}
+
+void condBroadcast(CondVar *cond) {
+    WakeAllConditionVariable(&cond->cond);
+}
+
+static BOOL CALLBACK onceTrampoline(PINIT_ONCE once, PVOID parameter, PVOID *context) {
+    ((void (*)(void)) parameter)();
+    return TRUE;
+}
+
+void onceRun(Once *once, void (*func)(void)) {
+    InitOnceExecuteOnce(&once->once, onceTrampoline, (PVOID) func, NULL);
+}
+
+uint32_t cpuCount(void) {
+    // Unlike GetSystemInfo(), this counts every processor group, not just the first 64 processors
+    DWORD count = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+    return count ? count : 1;
+}
+
+double platformSeconds(void) {
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double) counter.QuadPart / (double) frequency.QuadPart;
+}
+
+double platformCpuSeconds(void) {
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+        return 0;
+    }
+    // FILETIMEs count 100 ns intervals
+    uint64_t kernelTime = (uint64_t) kernel.dwHighDateTime << 32 | kernel.dwLowDateTime;
+    uint64_t userTime = (uint64_t) user.dwHighDateTime << 32 | user.dwLowDateTime;
+    return (double) (kernelTime + userTime) * 1e-7;
+}
+
+uint64_t platformPeakMemory(void) {
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return counters.PeakWorkingSetSize;
+}
+
+int platformResetPeakMemory(void) {
+    return 1; // the peak working set only ever grows
+}
+
+char **platformUtf8Args(int argc, char *argv[]) {
+    int nArgs;
+    LPWSTR *szArglist = CommandLineToArgvW(GetCommandLineW(), &nArgs);
+    if (NULL == szArglist || nArgs != argc) {
+        return NULL;
+    }
+
+    char **args = calloc((size_t) argc + 1, sizeof(char *));
+    if (args == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < argc; i++) {
+        int size = WideCharToMultiByte(CP_UTF8, 0, szArglist[i], -1, NULL, 0, NULL, NULL);
+        args[i] = malloc(size);
+        if (args[i] == NULL) {
+            return NULL;
+        }
+        WideCharToMultiByte(CP_UTF8, 0, szArglist[i], -1, args[i], size, NULL, NULL);
+    }
+    LocalFree(szArglist);
+    return args;
+}
+
+wchar_t *platformWidenString(const char *s) {
+    int size = MultiByteToWideChar(CP_UTF8, 0, s, -1, NULL, 0);
+    if (size == 0) {
+        return NULL;
+    }
+    wchar_t *wide = malloc(sizeof(wchar_t) * size);
+    if (wide != NULL) {
+        MultiByteToWideChar(CP_UTF8, 0, s, -1, wide, size);
+    }
+    return wide;
+}
+
+FILE *platformFopen(const char *path, const char *mode) {
+    wchar_t *widePath = platformWidenString(path);
+    wchar_t *wideMode = platformWidenString(mode);
+    FILE *f = NULL;
+    if (widePath != NULL && wideMode != NULL) {
+        f = _wfopen(widePath, wideMode);
+    }
+    free(widePath);
+    free(wideMode);
+    return f;
+}
+
+void platformSetBinaryMode(FILE *f) {
+    _setmode(_fileno(f), _O_BINARY);
+}
+
+int platformFseek64(FILE *f, int64_t offset, int origin) {
+    return _fseeki64(f, offset, origin);
+}
+
+int platformIsDirectory(const char *path) {
+    wchar_t *widePath = platformWidenString(path);
+    if (widePath == NULL) {
+        return 0;
+    }
+    DWORD attributes = GetFileAttributesW(widePath);
+    free(widePath);
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+int platformListDirectory(const char *path, char ***paths) {
+    size_t length = strlen(path);
+    char *pattern = malloc(length + 3);
+    if (pattern == NULL) {
+        return -1;
+    }
+    strcpy(pattern, path);
+    strcpy(pattern + length, length && (path[length - 1] == '\\' || path[length - 1] == '/') ? "*" : "\\*");
+    wchar_t *widePattern = platformWidenString(pattern);
+    free(pattern);
+    if (widePattern == NULL) {
+        return -1;
+    }
+
+    WIN32_FIND_DATAW findData;
+    HANDLE find = FindFirstFileW(widePattern, &findData);
+    free(widePattern);
+    if (find == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+
+    char **result = NULL;
+    int count = 0;
+    int capacity = 0;
+    int failed = 0;
+
+    do {
+        if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            continue;
+        }
+        char name[MAX_PATH * 3];
+        if (!WideCharToMultiByte(CP_UTF8, 0, findData.cFileName, -1, name, sizeof(name), NULL, NULL) ||
+            appendPath(&result, &count, &capacity, path, name, '\\')) {
+            failed = 1;
+            break;
+        }
+    } while (FindNextFileW(find, &findData));
+
+    FindClose(find);
+
+    if (failed) {
+        freePaths(result, count);
+        return -1;
+    }
+    *paths = result;
+    return count;
+}
+
+int platformFileInfo(const char *path, uint64_t *size, int64_t *modified) {
+    wchar_t *widePath = platformWidenString(path);
+    if (widePath == NULL) {
+        return 1;
+    }
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    BOOL found = GetFileAttributesExW(widePath, GetFileExInfoStandard, &data);
+    free(widePath);
+    if (!found) {
+        return 1;
+    }
+    *size = (uint64_t) data.nFileSizeHigh << 32 | data.nFileSizeLow;
+    *modified = (int64_t) ((uint64_t) data.ftLastWriteTime.dwHighDateTime << 32 | data.ftLastWriteTime.dwLowDateTime);
+    return 0;
+}
+
+int platformMapFile(const char *path, MappedFile *file) {
+    wchar_t *widePath = platformWidenString(path);
+    if (widePath == NULL) {
+        return 1;
+    }
+    HANDLE handle = CreateFileW(widePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL, NULL);
+    free(widePath);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return 1;
+    }
+
+    LARGE_INTEGER size;
+    HANDLE mapping = NULL;
+    void *data = NULL;
+    if (GetFileSizeEx(handle, &size) && size.QuadPart > 0 && (uint64_t) size.QuadPart <= SIZE_MAX) {
+        mapping = CreateFileMappingW(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+    if (mapping != NULL) {
+        data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+    // The view keeps the mapping alive by itself
+    if (mapping != NULL) {
+        CloseHandle(mapping);
+    }
+
+    if (data == NULL) {
+        CloseHandle(handle);
+        return 1;
+    }
+    file->data = data;
+    file->size = (size_t) size.QuadPart;
+    file->handle = handle;
+    return 0;
+}
+
+void platformUnmapFile(MappedFile *file) {
+    UnmapViewOfFile(file->data);
+    CloseHandle(file->handle);
+    file->data = NULL;
+    file->size = 0;
+    file->handle = NULL;
+}
+
+int platformGuardMapped(int (*func)(void *arg), void *arg) {
+    return func(arg);
+}
+
+int platformWriteFileAtomic(const char *path, const void *data, size_t size) {
+    char *temporary = temporaryPath(path, GetCurrentProcessId());
+    wchar_t *widePath = platformWidenString(path);
+    wchar_t *wideTemporary = temporary ? platformWidenString(temporary) : NULL;
+    free(temporary);
+    if (widePath == NULL || wideTemporary == NULL) {
+        free(widePath);
+        free(wideTemporary);
+        return 1;
+    }
+
+    int returnCode = 1;
+    HANDLE handle = CreateFileW(wideTemporary, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        goto cleanup;
+    }
+
+    const uint8_t *p = data;
+    while (size > 0) {
+        DWORD written;
+        if (!WriteFile(handle, p, (DWORD) min(size, WRITE_CHUNK), &written, NULL) || written == 0) {
+            break;
+        }
+        p += written;
+        size -= written;
+    }
+    // Flushed before the rename, so that after a crash the output is either the old file or the whole new one
+    BOOL flushed = size == 0 && FlushFileBuffers(handle);
+    if (CloseHandle(handle) && flushed) {
+        // ReplaceFileW keeps the attributes and security of the file being replaced
+        if (GetFileAttributesW(widePath) != INVALID_FILE_ATTRIBUTES) {
+            flushed = ReplaceFileW(widePath, wideTemporary, NULL, REPLACEFILE_IGNORE_MERGE_ERRORS, NULL, NULL);
+        } else {
+            flushed = MoveFileExW(wideTemporary, widePath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+        }
+        returnCode = !flushed;
+    }
+    if (returnCode) {
+        DeleteFileW(wideTemporary);
+    }
+
+    cleanup:
+    free(widePath);
+    free(wideTemporary);
+    return returnCode;
+}
+
+struct DirectoryWatch {
+    HANDLE handle;
+};
+
+DirectoryWatch *platformWatchDirectory(const char *path) {
+    wchar_t *widePath = platformWidenString(path);
+    if (widePath == NULL) {
+        return NULL;
+    }
+    HANDLE handle = FindFirstChangeNotificationW(widePath, FALSE, FILE_NOTIFY_CHANGE_FILE_NAME |
+                                                                 FILE_NOTIFY_CHANGE_SIZE |
+                                                                 FILE_NOTIFY_CHANGE_LAST_WRITE);
+    free(widePath);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+
+    DirectoryWatch *watch = malloc(sizeof(DirectoryWatch));
+    if (watch == NULL) {
+        FindCloseChangeNotification(handle);
+        return NULL;
+    }
+    watch->handle = handle;
+    return watch;
+}
+
+int platformWatchWait(DirectoryWatch *watch, uint32_t timeoutMs) {
+    if (watch == NULL) {
+        Sleep(timeoutMs);
+        return 0;
+    }
+    if (WaitForSingleObject(watch->handle, timeoutMs) != WAIT_OBJECT_0) {
+        return 0;
+    }
+    FindNextChangeNotification(watch->handle);
+    return 1;
+}
+
+void platformWatchClose(DirectoryWatch *watch) {
+    if (watch) {
+        FindCloseChangeNotification(watch->handle);
+        free(watch);
+    }
+}
+
+#else
+
+static void *threadTrampoline(void *arg) {
+    Thread *thread = (Thread *) arg;
+    thread->exitCode = thread->proc(thread->arg);
+    return NULL;
+}
+
+int threadCreate(Thread *thread, ThreadProc proc, void *arg) {
+    thread->proc = proc;
+    thread->arg = arg;
+    thread->exitCode = 0;
+    return pthread_create(&thread->handle, NULL, threadTrampoline, thread) ? 1 : 0;
+}
+
+int threadJoin(Thread *thread) {
+    if (pthread_join(thread->handle, NULL)) {
+        return -1;
+    }
+    return thread->exitCode;
+}
+
+int mutexInit(Mutex *mutex) {
+    return pthread_mutex_init(&mutex->lock, NULL) ? 1 : 0;
+}
+
+void mutexDestroy(Mutex *mutex) {
+    pthread_mutex_destroy(&mutex->lock);
+}
+
+void mutexLock(Mutex *mutex) {
+    pthread_mutex_lock(&mutex->lock);
+}
+
+void mutexUnlock(Mutex *mutex) {
+    pthread_mutex_unlock(&mutex->lock);
+}
+
+int condInit(CondVar *cond) {
+    return pthread_cond_init(&cond->cond, NULL) ? 1 : 0;
+}
+
+void condDestroy(CondVar *cond) {
+    pthread_cond_destroy(&cond->cond);
+}
+
+void condWait(CondVar *cond, Mutex *mutex) {
+    pthread_cond_wait(&cond->cond, &mutex->lock);
+}
+
+void condBroadcast(CondVar *cond) {
+    pthread_cond_broadcast(&cond->cond);
+}
+
+void onceRun(Once *once, void (*func)(void)) {
+    pthread_once(&once->once, func);
+}
+
+uint32_t cpuCount(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (uint32_t) n : 1;
+}
+
+double platformSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+double platformCpuSeconds(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage)) {
+        return 0;
+    }
+    return (double) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+           (double) (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+uint64_t platformPeakMemory(void) {
+#ifdef __linux__
+    // Unlike ru_maxrss, VmHWM starts over with platformResetPeakMemory()
+    FILE *f = fopen("/proc/self/status", "r");
+    if (f) {
+        char line[256];
+        unsigned long long kilobytes;
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "VmHWM: %llu kB", &kilobytes) == 1) {
+                fclose(f);
+                return kilobytes * 1024;
+            }
+        }
+        fclose(f);
+    }
+#endif
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage)) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return (uint64_t) usage.ru_maxrss; // bytes on macOS, kilobytes elsewhere
+#else
+    return (uint64_t) usage.ru_maxrss * 1024;
+#endif
+}
+
+int platformResetPeakMemory(void) {
+#ifdef __linux__
+    // Resets VmHWM to the current resident memory
+    FILE *f = fopen("/proc/self/clear_refs", "w");
+    if (f == NULL) {
+        return 1;
+    }
+    int failed = fputs("5", f) < 0;
+    return fclose(f) || failed;
+#else
+    return 1;
+#endif
+}
+
+char **platformUtf8Args(int argc, char *argv[]) {
+    (void) argc;
+    return argv;
+}
+
+FILE *platformFopen(const char *path, const char *mode) {
+    return fopen(path, mode);
+}
+
+void platformSetBinaryMode(FILE *f) {
+    (void) f;
+}
+
+int platformFseek64(FILE *f, int64_t offset, int origin) {
+    return fseeko(f, (off_t) offset, origin);
+}
+
+int platformIsDirectory(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+int platformListDirectory(const char *path, char ***paths) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return -1;
+    }
+
+    char **result = NULL;
+    int count = 0;
+    int capacity = 0;
+    int failed = 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (appendPath(&result, &count, &capacity, path, entry->d_name, '/')) {
+            failed = 1;
+            break;
+        }
+        struct stat st;
+        if (stat(result[count - 1], &st) != 0 || !S_ISREG(st.st_mode)) {
+            free(result[--count]);
+        }
+    }
+
+    closedir(dir);
+
+    if (failed) {
+        freePaths(result, count);
+        return -1;
+    }
+    *paths = result;
+    return count;
+}
+
+int platformFileInfo(const char *path, uint64_t *size, int64_t *modified) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return 1;
+    }
+    *size = (uint64_t) st.st_size;
+#ifdef __linux__
+    *modified = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#else
+    *modified = (int64_t) st.st_mtime;
+#endif
+    return 0;
+}
+
+// Where a fault in a mapped file jumps to on this thread, NULL outside of platformGuardMapped()
+static _Thread_local sigjmp_buf *mappedFault;
+static pthread_once_t busHandlerOnce = PTHREAD_ONCE_INIT;
+
+static void busHandler(int signal) {
+    if (mappedFault) {
+        siglongjmp(*mappedFault, 1);
+    }
+    // Not a read of a mapped file, so the default action is the right one
+    sigaction(SIGBUS, &(struct sigaction) {.sa_handler = SIG_DFL}, NULL);
+    raise(signal);
+}
+
+static void installBusHandler(void) {
+    struct sigaction action = {0};
+    action.sa_handler = busHandler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGBUS, &action, NULL);
+}
+
+int platformMapFile(const char *path, MappedFile *file) {
+    pthread_once(&busHandlerOnce, installBusHandler);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 1;
+    }
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && (uint64_t) st.st_size <= SIZE_MAX) {
+        data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    // The mapping keeps the file open by itself
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        return 1;
+    }
+    file->data = data;
+    file->size = (size_t) st.st_size;
+    return 0;
+}
+
+void platformUnmapFile(MappedFile *file) {
+    munmap((void *) file->data, file->size);
+    file->data = NULL;
+    file->size = 0;
+}
+
+int platformGuardMapped(int (*func)(void *arg), void *arg) {
+    sigjmp_buf jump;
+    sigjmp_buf *outer = mappedFault;
+    if (sigsetjmp(jump, 1)) {
+        mappedFault = outer;
+        return -1;
+    }
+    mappedFault = &jump;
+    int result = func(arg);
+    mappedFault = outer;
+    return result;
+}
+
+int platformWriteFileAtomic(const char *path, const void *data, size_t size) {
+    char *temporary = temporaryPath(path, (unsigned long) getpid());
+    if (temporary == NULL) {
+        return 1;
+    }
+
+    int returnCode = 1;
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        goto cleanup;
+    }
+
+    // A replaced file keeps its permissions, the owner is that of this process like for any new file
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        fchmod(fd, st.st_mode & 07777);
+    }
+
+    const uint8_t *p = data;
+    while (size > 0) {
+        ssize_t written = write(fd, p, min(size, WRITE_CHUNK));
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            break;
+        }
+        p += written;
+        size -= (size_t) written;
+    }
+
+    // Synced before the rename, so that after a crash the output is either the old file or the whole new one
+    int synced = size == 0 && fsync(fd) == 0;
+    if (close(fd) == 0 && synced && rename(temporary, path) == 0) {
+        returnCode = 0;
+    } else {
+        unlink(temporary);
+    }
+
+    cleanup:
+    free(temporary);
+    return returnCode;
+}
+
+struct DirectoryWatch {
+    int fd;
+};
+
+DirectoryWatch *platformWatchDirectory(const char *path) {
+#ifdef __linux__
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (inotify_add_watch(fd, path, IN_CREATE | IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_MOVED_FROM |
+                                    IN_DELETE) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    DirectoryWatch *watch = malloc(sizeof(DirectoryWatch));
+    if (watch == NULL) {
+        close(fd);
+        return NULL;
+    }
+    watch->fd = fd;
+    return watch;
+#else
+    (void) path;
+    return NULL;
+#endif
+}
+
+int platformWatchWait(DirectoryWatch *watch, uint32_t timeoutMs) {
+    if (watch == NULL) {
+        struct timespec ts = {timeoutMs / 1000, (long) (timeoutMs % 1000) * 1000000};
+        nanosleep(&ts, NULL);
+        return 0;
+    }
+
+    struct pollfd pfd = {watch->fd, POLLIN, 0};
+    if (poll(&pfd, 1, (int) timeoutMs) <= 0) {
+        return 0;
+    }
+
+    // Only whether something changed matters, so the events are drained unread
+    char buffer[4096];
+    while (read(watch->fd, buffer, sizeof(buffer)) > 0) {
+    }
+    return 1;
+}
+
+void platformWatchClose(DirectoryWatch *watch) {
+    if (watch) {
+        close(watch->fd);
+        free(watch);
+    }
+}
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef JXR_TO_AVIF_PLATFORM_H
+#define JXR_TO_AVIF_PLATFORM_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+typedef int (*ThreadProc)(void *arg);
+
+typedef struct Thread {
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+    ThreadProc proc;
+    void *arg;
+    int exitCode;
+} Thread;
+
+// Starts proc(arg) on a new thread. Returns 0 on success.
+int threadCreate(Thread *thread, ThreadProc proc, void *arg);
+
+// Waits for the thread to finish and returns its exit code, or -1 if it could not be joined.
+int threadJoin(Thread *thread);
+
+typedef struct Mutex {
+#ifdef _WIN32
+    SRWLOCK lock;
+#else
+    pthread_mutex_t lock;
+#endif
+} Mutex;
+
+typedef struct CondVar {
+#ifdef _WIN32
+    CONDITION_VARIABLE cond;
+#else
+    pthread_cond_t cond;
+#endif
+} CondVar;
+
+// Mutexes and condition variables, none of these can fail once initialized. Init returns 0 on success.
+int mutexInit(Mutex *mutex);
+void mutexDestroy(Mutex *mutex);
+void mutexLock(Mutex *mutex);
+void mutexUnlock(Mutex *mutex);
+int condInit(CondVar *cond);
+void condDestroy(CondVar *cond);
+void condWait(CondVar *cond, Mutex *mutex);
+void condBroadcast(CondVar *cond);
+
+// One-time initialization: the first call of onceRun() runs func, all others wait until it is done
+typedef struct Once {
+#ifdef _WIN32
+    INIT_ONCE once;
+#else
+    pthread_once_t once;
+#endif
+} Once;
+
+#ifdef _WIN32
+#define ONCE_INIT {INIT_ONCE_STATIC_INIT}
+#else
+#define ONCE_INIT {PTHREAD_ONCE_INIT}
+#endif
+
+void onceRun(Once *once, void (*func)(void));
+
+uint32_t cpuCount(void);
+
+// Monotonic wall clock time in seconds, for measuring intervals
+double platformSeconds(void);
+
+// CPU time used by all threads of the process so far, in seconds
+double platformCpuSeconds(void);
+
+// Peak resident memory of the process so far, or since the last platformResetPeakMemory(), in bytes
+uint64_t platformPeakMemory(void);
+
+// Starts the peak of platformPeakMemory() over from the current resident memory. Returns 0 on success, nonzero
+// where the peak can't be reset, which is everywhere except Linux.
+int platformResetPeakMemory(void);
+
+// Returns argv as UTF-8 strings. On Windows the arguments are re-read from the wide command line,
+// elsewhere argv is returned unchanged.
+char **platformUtf8Args(int argc, char *argv[]);
+
+// fopen() for UTF-8 paths
+FILE *platformFopen(const char *path, const char *mode);
+
+// Stops the C runtime from translating line endings, which Windows does for the standard streams
+void platformSetBinaryMode(FILE *f);
+
+// fseek() with 64-bit offsets
+int platformFseek64(FILE *f, int64_t offset, int origin);
+
+// Returns 1 if path is an existing directory
+int platformIsDirectory(const char *path);
+
+// Lists the regular files in a directory, not recursing into subdirectories. On success, *paths is set to a
+// newly allocated array of UTF-8 paths (the directory joined with each file name) and the number of files
+// is returned. Returns -1 on failure. free() each path and the array.
+int platformListDirectory(const char *path, char ***paths);
+
+// Size and last modification time of a file, the latter only for comparison with an earlier one. Returns 0 on
+// success, nonzero if the file doesn't exist.
+int platformFileInfo(const char *path, uint64_t *size, int64_t *modified);
+
+// A whole file mapped read-only into memory
+typedef struct MappedFile {
+    const uint8_t *data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE handle; // kept open without write sharing, so that the file can't change while it is mapped
+#endif
+} MappedFile;
+
+// Maps the file at path. Returns 0 on success, nonzero on failure, which includes empty files as they can't be
+// mapped.
+int platformMapFile(const char *path, MappedFile *file);
+void platformUnmapFile(MappedFile *file);
+
+// Calls func(arg) and returns its result, or -1 if it read a page of a mapped file that another process truncated
+// in the meantime, which would otherwise kill the process with SIGBUS. Windows keeps mapped files from changing,
+// so there it only calls func.
+int platformGuardMapped(int (*func)(void *arg), void *arg);
+
+// Writes data to path through a temporary file in the same directory, which replaces path once it is complete, so
+// that readers only ever see the old file or the whole new one, even after a crash. A replaced file keeps its
+// permissions (on Windows, its attributes and security), but the owner is that of this process. Returns 0 on
+// success.
+int platformWriteFileAtomic(const char *path, const void *data, size_t size);
+
+// Change notifications for the files in a directory
+typedef struct DirectoryWatch DirectoryWatch;
+
+// Starts watching a directory, not recursing into subdirectories. Returns NULL if the platform has no
+// notifications, in which case the directory can only be polled.
+DirectoryWatch *platformWatchDirectory(const char *path);
+
+// Waits up to timeoutMs milliseconds for a file in the directory to be created, written, renamed or deleted.
+// Returns 1 if one was, 0 on timeout. With a NULL watch, just sleeps for the timeout.
+int platformWatchWait(DirectoryWatch *watch, uint32_t timeoutMs);
+
+void platformWatchClose(DirectoryWatch *watch);
+
+#ifdef _WIN32
+// Converts a UTF-8 string to a newly allocated wide string, free() the result
+wchar_t *platformWidenString(const char *s);
+#endif
+
+#endif // JXR_TO_AVIF_PLATFORM_H
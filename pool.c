@@ -0,0 +1,220 @@
+#include "pool.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "platform.h"
+
+// The chunks a worker has left, as front | back << 32. The owner takes chunks from the front, thieves from
+// the back, both with a compare-and-swap on the whole range. Padded so that queues don't share cache lines.
+typedef struct PoolQueue {
+    atomic_uint_least64_t range;
+    char padding[64 - sizeof(atomic_uint_least64_t)];
+} PoolQueue;
+
+typedef struct PoolWorker {
+    ThreadPool *pool;
+    uint32_t index;
+} PoolWorker;
+
+struct ThreadPool {
+    uint32_t threadCount;
+    Thread *threads;
+    PoolWorker *workers;
+    PoolQueue *queues;
+
+    Mutex mutex;
+    CondVar wake;
+    CondVar done;
+    uint64_t generation;
+    uint32_t running;
+    int shutdown;
+
+    PoolTask task;
+    void *arg;
+    uint32_t count;
+    uint32_t grain;
+};
+
+static uint64_t packRange(uint32_t front, uint32_t back) {
+    return (uint64_t) front | (uint64_t) back << 32;
+}
+
+static int takeFront(PoolQueue *queue, uint32_t *chunk) {
+    uint64_t range = atomic_load(&queue->range);
+    while (1) {
+        uint32_t front = (uint32_t) range;
+        uint32_t back = (uint32_t) (range >> 32);
+        if (front >= back) {
+            return 0;
+        }
+        if (atomic_compare_exchange_weak(&queue->range, &range, packRange(front + 1, back))) {
+            *chunk = front;
+            return 1;
+        }
+    }
+}
+
+static int takeBack(PoolQueue *queue, uint32_t *chunk) {
+    uint64_t range = atomic_load(&queue->range);
+    while (1) {
+        uint32_t front = (uint32_t) range;
+        uint32_t back = (uint32_t) (range >> 32);
+        if (front >= back) {
+            return 0;
+        }
+        if (atomic_compare_exchange_weak(&queue->range, &range, packRange(front, back - 1))) {
+            *chunk = back - 1;
+            return 1;
+        }
+    }
+}
+
+// Works through the own queue, then steals from the others until all of them are empty
+static void runChunks(ThreadPool *pool, uint32_t index) {
+    while (1) {
+        uint32_t chunk;
+        int found = takeFront(&pool->queues[index], &chunk);
+        for (uint32_t k = 1; k < pool->threadCount && !found; k++) {
+            found = takeBack(&pool->queues[(index + k) % pool->threadCount], &chunk);
+        }
+        if (!found) {
+            return;
+        }
+
+        uint32_t begin = chunk * pool->grain;
+        uint32_t end = begin + min(pool->grain, pool->count - begin);
+        pool->task(pool->arg, index, begin, end);
+    }
+}
+
+static int workerFunc(void *arg) {
+    PoolWorker *worker = (PoolWorker *) arg;
+    ThreadPool *pool = worker->pool;
+    uint64_t seen = 0;
+
+    mutexLock(&pool->mutex);
+    while (1) {
+        while (!pool->shutdown && pool->generation == seen) {
+            condWait(&pool->wake, &pool->mutex);
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        seen = pool->generation;
+        mutexUnlock(&pool->mutex);
+
+        runChunks(pool, worker->index);
+
+        mutexLock(&pool->mutex);
+        if (--pool->running == 0) {
+            condBroadcast(&pool->done);
+        }
+    }
+    mutexUnlock(&pool->mutex);
+
+    return 0;
+}
+
+ThreadPool *poolCreate(uint32_t threads) {
+    ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pool->threadCount = max(threads, 1);
+    pool->threads = calloc(pool->threadCount, sizeof(Thread));
+    pool->workers = calloc(pool->threadCount, sizeof(PoolWorker));
+    pool->queues = calloc(pool->threadCount, sizeof(PoolQueue));
+
+    if (pool->threads == NULL || pool->workers == NULL || pool->queues == NULL ||
+        mutexInit(&pool->mutex) || condInit(&pool->wake) || condInit(&pool->done)) {
+        free(pool->threads);
+        free(pool->workers);
+        free(pool->queues);
+        free(pool);
+        return NULL;
+    }
+
+    // Worker 0 is whoever calls poolRun()
+    for (uint32_t i = 0; i < pool->threadCount; i++) {
+        atomic_init(&pool->queues[i].range, 0);
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+    }
+
+    for (uint32_t i = 1; i < pool->threadCount; i++) {
+        if (threadCreate(&pool->threads[i], workerFunc, &pool->workers[i])) {
+            pool->threadCount = i;
+            poolDestroy(pool);
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+void poolDestroy(ThreadPool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    mutexLock(&pool->mutex);
+    pool->shutdown = 1;
+    condBroadcast(&pool->wake);
+    mutexUnlock(&pool->mutex);
+
+    for (uint32_t i = 1; i < pool->threadCount; i++) {
+        threadJoin(&pool->threads[i]);
+    }
+
+    condDestroy(&pool->done);
+    condDestroy(&pool->wake);
+    mutexDestroy(&pool->mutex);
+    free(pool->threads);
+    free(pool->workers);
+    free(pool->queues);
+    free(pool);
+}
+
+uint32_t poolThreads(const ThreadPool *pool) {
+    return pool->threadCount;
+}
+
+void poolRun(ThreadPool *pool, uint32_t count, uint32_t grain, PoolTask task, void *arg) {
+    if (count == 0) {
+        return;
+    }
+    grain = max(grain, 1);
+    uint32_t chunks = (count - 1) / grain + 1;
+
+    pool->task = task;
+    pool->arg = arg;
+    pool->count = count;
+    pool->grain = grain;
+
+    uint32_t threads = pool->threadCount;
+    for (uint32_t i = 0; i < threads; i++) {
+        uint32_t front = (uint32_t) ((uint64_t) chunks * i / threads);
+        uint32_t back = (uint32_t) ((uint64_t) chunks * (i + 1) / threads);
+        atomic_store(&pool->queues[i].range, packRange(front, back));
+    }
+
+    if (threads > 1) {
+        mutexLock(&pool->mutex);
+        pool->running = threads - 1;
+        pool->generation++;
+        condBroadcast(&pool->wake);
+        mutexUnlock(&pool->mutex);
+    }
+
+    runChunks(pool, 0);
+
+    if (threads > 1) {
+        mutexLock(&pool->mutex);
+        while (pool->running) {
+            condWait(&pool->done, &pool->mutex);
+        }
+        mutexUnlock(&pool->mutex);
+    }
+}
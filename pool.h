@@ -0,0 +1,26 @@
+#ifndef JXR_TO_AVIF_POOL_H
+#define JXR_TO_AVIF_POOL_H
+
+#include <stdint.h>
+
+// Persistent worker threads for the parallel stages. Work is split into chunks that are dealt out evenly up
+// front; a worker that runs out takes chunks from the end of another worker's share, so slow regions of an
+// image don't leave the other threads idle.
+typedef struct ThreadPool ThreadPool;
+
+// Processes items [begin, end) of a poolRun() call. worker is in [0, poolThreads()) and identifies the
+// calling thread, so it can be used to index per-thread state.
+typedef void (*PoolTask)(void *arg, uint32_t worker, uint32_t begin, uint32_t end);
+
+// Creates a pool of the given number of threads, counting the thread that calls poolRun()
+ThreadPool *poolCreate(uint32_t threads);
+
+void poolDestroy(ThreadPool *pool);
+
+uint32_t poolThreads(const ThreadPool *pool);
+
+// Runs task over items [0, count) in chunks of up to grain items on all threads of the pool, including the
+// calling one, and returns once every chunk is done. Must not be called from a task or from two threads at once.
+void poolRun(ThreadPool *pool, uint32_t count, uint32_t grain, PoolTask task, void *arg);
+
+#endif // JXR_TO_AVIF_POOL_H
@@ -0,0 +1,229 @@
+#include "serve.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+#include "unix_socket.h"
+
+#define SERVE_MAX_INPUT ((uint64_t) 2 << 30)  // 2 GB, far beyond any screenshot, so a bad size can't exhaust memory
+
+// Connections accepted and waiting for a worker, in a ring of queueSize entries
+typedef struct ServeQueue {
+    const ConvertOptions *options;
+    Mutex mutex;
+    CondVar cond; // signaled whenever a connection is added or taken
+    Socket **connections;
+    uint32_t capacity;
+    uint32_t first;
+    uint32_t count;
+} ServeQueue;
+
+typedef struct ServeWorker {
+    ServeQueue *q;
+    ThreadPool *pool;
+    Thread thread;
+} ServeWorker;
+
+static uint32_t readLe32(const uint8_t *p) {
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint64_t readLe64(const uint8_t *p) {
+    return readLe32(p) | (uint64_t) readLe32(p + 4) << 32;
+}
+
+static void writeLe16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+}
+
+static void writeLe32(uint8_t *p, uint32_t v) {
+    writeLe16(p, (uint16_t) v);
+    writeLe16(p + 2, (uint16_t) (v >> 16));
+}
+
+static void writeLe64(uint8_t *p, uint64_t v) {
+    writeLe32(p, (uint32_t) v);
+    writeLe32(p + 4, (uint32_t) (v >> 32));
+}
+
+// Sends the response header followed by size bytes of data. Returns 0 on success.
+static int sendResponse(Socket *connection, ServeStatus status, const ConvertResult *result, const void *data,
+                        size_t size) {
+    uint8_t header[SERVE_RESPONSE_SIZE];
+    writeLe32(header, status);
+    writeLe16(header + 4, result ? result->maxCLL : 0);
+    writeLe16(header + 6, result ? result->maxPALL : 0);
+    writeLe64(header + 8, size);
+    return socketWrite(connection, header, sizeof(header)) || socketWrite(connection, data, size);
+}
+
+static int sendError(Socket *connection, ServeStatus status, const char *message) {
+    return sendResponse(connection, status, NULL, message, strlen(message));
+}
+
+// Reports a failed read of the request, answering a client that stopped sending, which is still there to read it
+static void readFailed(Socket *connection, int error) {
+    if (error == SOCKET_TIMED_OUT) {
+        fprintf(stderr, "Timed out reading request\n");
+        sendError(connection, SERVE_BAD_REQUEST, "Timed out reading request");
+    } else {
+        fprintf(stderr, "Failed to read request\n");
+    }
+}
+
+// Reads one request from the connection, converts it on the pool and sends back the result
+static void serveRequest(const ConvertOptions *baseOptions, Socket *connection, ThreadPool *pool) {
+    uint8_t header[SERVE_REQUEST_SIZE];
+    int error = socketRead(connection, header, sizeof(header));
+    if (error) {
+        readFailed(connection, error);
+        return;
+    }
+
+    ConvertOptions options = *baseOptions;
+    options.speed = (int) readLe32(header + 4);
+    options.depth = readLe32(header + 8);
+    uint32_t format = readLe32(header + 12);
+    uint32_t maxCllMode = readLe32(header + 16);
+    uint64_t size = readLe64(header + 20);
+
+    if (memcmp(header, SERVE_REQUEST_MAGIC, 4) || options.speed < AVIF_SPEED_SLOWEST ||
+        options.speed > AVIF_SPEED_FASTEST || (options.depth != 10 && options.depth != 12) ||
+        format > CONVERT_FORMAT_RGB || maxCllMode > MAXCLL_MODE_NONE || size == 0 || size > SERVE_MAX_INPUT) {
+        fprintf(stderr, "Invalid request\n");
+        sendError(connection, SERVE_BAD_REQUEST, "Invalid request");
+        return;
+    }
+    options.format = (ConvertFormat) format;
+    options.maxCllMode = (MaxCllMode) maxCllMode;
+
+    uint8_t *input = malloc(size);
+    if (input == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        sendError(connection, SERVE_FAILED, "Out of memory");
+        return;
+    }
+    error = socketRead(connection, input, size);
+    if (error) {
+        readFailed(connection, error);
+        free(input);
+        return;
+    }
+
+    double start = platformSeconds();
+    avifRWData avif = AVIF_DATA_EMPTY;
+    ConvertResult result;
+    PixelSource *source = pixelSourceOpenBuffer(input, size);
+    uint32_t width = source ? source->width : 0;
+    uint32_t height = source ? source->height : 0;
+    // The source only borrows the input, and is destroyed by convertSource()
+    int failed = source == NULL || convertSource(&options, source, pool, 0, &avif, &result);
+    free(input);
+
+    if (failed) {
+        fprintf(stderr, "Failed to convert request\n");
+        sendError(connection, SERVE_FAILED, "Failed to convert");
+        return;
+    }
+
+    if (sendResponse(connection, SERVE_OK, &result, avif.data, avif.size)) {
+        fprintf(stderr, "Failed to send response\n");
+    } else {
+        printf("Converted %ux%u to %zu bytes in %.2f s\n", width, height, avif.size, platformSeconds() - start);
+        fflush(stdout);
+    }
+    avifRWDataFree(&avif);
+}
+
+// Worker of the server: serves queued connections for as long as the process runs, all on the same pool
+static int ServeFunc(void *arg) {
+    ServeWorker *worker = (ServeWorker *) arg;
+    ServeQueue *q = worker->q;
+
+    while (1) {
+        mutexLock(&q->mutex);
+        while (q->count == 0) {
+            condWait(&q->cond, &q->mutex);
+        }
+        Socket *connection = q->connections[q->first];
+        q->first = (q->first + 1) % q->capacity;
+        q->count--;
+        condBroadcast(&q->cond);
+        mutexUnlock(&q->mutex);
+
+        serveRequest(q->options, connection, worker->pool);
+        socketClose(connection);
+    }
+    return 0;
+}
+
+int runServer(const ConvertOptions *options, const char *path, uint32_t numThreads, uint32_t jobs,
+              uint32_t queueSize) {
+    uint32_t threadsPerJob = max(1, numThreads / jobs);
+
+    ServeQueue q = {0};
+    q.options = options;
+    q.capacity = queueSize;
+    q.connections = calloc(queueSize, sizeof(Socket *));
+    if (q.connections == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    if (mutexInit(&q.mutex) || condInit(&q.cond)) {
+        fprintf(stderr, "Failed to create mutex\n");
+        return 1;
+    }
+
+    // The requests share the threads, so the encoders of concurrent requests don't oversubscribe the CPU
+    ServeWorker *workers = calloc(jobs, sizeof(ServeWorker));
+    if (workers == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (uint32_t i = 0; i < jobs; i++) {
+        workers[i].q = &q;
+        workers[i].pool = poolCreate(threadsPerJob);
+        if (workers[i].pool == NULL || threadCreate(&workers[i].thread, ServeFunc, &workers[i])) {
+            fprintf(stderr, "Failed to create thread pool\n");
+            return 1;
+        }
+    }
+
+    Socket *server = socketListen(path, (int) queueSize);
+    if (server == NULL) {
+        return 1;
+    }
+    printf("Serving on %s, converting %u requests at a time with %u threads each, %u more can wait\n", path, jobs,
+           threadsPerJob, queueSize);
+    fflush(stdout);
+
+    while (1) {
+        // Once the queue is full, connections wait in the listen backlog and then in connect()
+        mutexLock(&q.mutex);
+        while (q.count == q.capacity) {
+            condWait(&q.cond, &q.mutex);
+        }
+        mutexUnlock(&q.mutex);
+
+        Socket *connection = socketAccept(server);
+        if (connection == NULL) {
+            fprintf(stderr, "Failed to accept connection\n");
+            continue;
+        }
+        // Without a timeout, a client that stops sending or reading would hold its worker forever
+        if (socketSetTimeout(connection, SERVE_TIMEOUT)) {
+            fprintf(stderr, "Failed to set socket timeout\n");
+            socketClose(connection);
+            continue;
+        }
+
+        mutexLock(&q.mutex);
+        q.connections[(q.first + q.count) % q.capacity] = connection;
+        q.count++;
+        condBroadcast(&q.cond);
+        mutexUnlock(&q.mutex);
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef JXR_TO_AVIF_SERVE_H
+#define JXR_TO_AVIF_SERVE_H
+
+#include <stdint.h>
+
+#include "pipeline.h"
+
+// Protocol of the server, one request per connection, all integers little-endian:
+// request:  "JXRA", u32 speed, u32 depth, u32 format (ConvertFormat), u32 MaxCLL mode (MaxCllMode), u64 size,
+//           then size bytes of an input file
+// response: u32 status (ServeStatus), u16 MaxCLL, u16 MaxPALL, u64 size, then size bytes of the AVIF file, or of
+//           an error message if the status is not SERVE_OK
+#define SERVE_REQUEST_MAGIC "JXRA"
+#define SERVE_REQUEST_SIZE 28
+#define SERVE_RESPONSE_SIZE 16
+// Longest time in milliseconds a client may send or read nothing while its request is served. A request that
+// stalls is answered with SERVE_BAD_REQUEST, a response that isn't read is dropped.
+#define SERVE_TIMEOUT 10000
+
+typedef enum ServeStatus {
+    SERVE_OK,
+    SERVE_BAD_REQUEST, // malformed header, invalid options, too large input or a stalled request
+    SERVE_FAILED,      // the input couldn't be decoded or converted
+} ServeStatus;
+
+// Serves conversions on a Unix domain socket at path until the process is ended, with the options of the command
+// line for everything a request doesn't set. jobs requests are converted at a time, each on its share of
+// numThreads threads, and up to queueSize more are accepted to wait for them. Only returns if it can't start.
+int runServer(const ConvertOptions *options, const char *path, uint32_t numThreads, uint32_t jobs,
+              uint32_t queueSize);
+
+#endif // JXR_TO_AVIF_SERVE_H
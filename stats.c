@@ -0,0 +1,168 @@
+#include "stats.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "platform.h"
+
+#define CACHE_LINE 64
+#define MERGE_CHUNK 4096 // histogram bins per work item of a merge round
+
+struct LightStatsThread {
+    uint64_t *histogram; // NULL if disabled
+    float scale;         // histogram bins per unit of maxComp
+    float max;
+    double sum;
+    uint64_t count;
+};
+
+struct LightStats {
+    uint32_t threadCount;
+    uint32_t binCount;
+    uint32_t binsPerNit;
+    size_t threadSize; // every thread gets its accumulators and histogram on cache lines of its own
+    uint8_t *memory;
+    uint8_t *threads;
+};
+
+static size_t roundUpToCacheLine(size_t size) {
+    return (size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+}
+
+LightStats *statsCreate(uint32_t threads, uint32_t binsPerNit) {
+    LightStats *stats = calloc(1, sizeof(LightStats));
+    if (stats == NULL) {
+        return NULL;
+    }
+
+    stats->threadCount = threads;
+    stats->binsPerNit = binsPerNit;
+    stats->binCount = binsPerNit ? 10000 * binsPerNit + 1 : 0; // maxComp == 1 maps to the last bin
+    size_t headerSize = roundUpToCacheLine(sizeof(LightStatsThread));
+    stats->threadSize = headerSize + roundUpToCacheLine((size_t) stats->binCount * sizeof(uint64_t));
+
+    // calloc only guarantees 16 byte alignment on some platforms
+    stats->memory = calloc(stats->threadSize * threads + CACHE_LINE - 1, 1);
+    if (stats->memory == NULL) {
+        free(stats);
+        return NULL;
+    }
+    stats->threads = (uint8_t *) (((uintptr_t) stats->memory + CACHE_LINE - 1) & ~(uintptr_t) (CACHE_LINE - 1));
+
+    for (uint32_t i = 0; i < threads; i++) {
+        LightStatsThread *t = statsThread(stats, i);
+        if (binsPerNit) {
+            t->histogram = (uint64_t *) ((uint8_t *) t + headerSize);
+            t->scale = 10000.f * (float) binsPerNit;
+        }
+    }
+    return stats;
+}
+
+void statsDestroy(LightStats *stats) {
+    if (stats) {
+        free(stats->memory);
+        free(stats);
+    }
+}
+
+LightStatsThread *statsThread(LightStats *stats, uint32_t thread) {
+    return (LightStatsThread *) (stats->threads + stats->threadSize * thread);
+}
+
+void statsAdd(LightStatsThread *t, const float *maxComp, uint32_t n) {
+    if (t->histogram) {
+        uint64_t *histogram = t->histogram;
+        float scale = t->scale;
+        for (uint32_t i = 0; i < n; i++) {
+            histogram[(uint32_t) roundf(maxComp[i] * scale)]++;
+        }
+    }
+
+    float maxValue = t->max;
+    double sum = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        maxValue = max(maxValue, maxComp[i]);
+        sum += maxComp[i];
+    }
+    t->max = maxValue;
+    t->sum += sum;
+    t->count += n;
+}
+
+typedef struct MergeRound {
+    LightStats *stats;
+    uint32_t stride; // distance between the threads of a pair
+    uint32_t chunks; // work items per pair
+} MergeRound;
+
+// Pool task, merges histogram chunks of the pairs of a round
+static void mergeChunks(void *arg, uint32_t worker, uint32_t begin, uint32_t end) {
+    MergeRound *round = (MergeRound *) arg;
+    LightStats *stats = round->stats;
+
+    for (uint32_t item = begin; item < end; item++) {
+        uint32_t pair = item / round->chunks;
+        uint32_t first = (item % round->chunks) * MERGE_CHUNK;
+        uint32_t last = min(first + MERGE_CHUNK, stats->binCount);
+
+        uint64_t *dst = statsThread(stats, 2 * round->stride * pair)->histogram;
+        const uint64_t *src = statsThread(stats, 2 * round->stride * pair + round->stride)->histogram;
+        for (uint32_t i = first; i < last; i++) {
+            dst[i] += src[i];
+        }
+    }
+}
+
+void statsMerge(LightStats *stats, ThreadPool *pool) {
+    uint32_t n = stats->threadCount;
+
+    for (uint32_t stride = 1; stride < n; stride *= 2) {
+        // Pairs are (i, i + stride) for every i that is a multiple of 2 * stride
+        uint32_t pairs = (n - stride + 2 * stride - 1) / (2 * stride);
+
+        if (stats->binCount) {
+            MergeRound round = {stats, stride, (stats->binCount + MERGE_CHUNK - 1) / MERGE_CHUNK};
+            if (pool) {
+                poolRun(pool, pairs * round.chunks, 1, mergeChunks, &round);
+            } else {
+                mergeChunks(&round, 0, 0, pairs * round.chunks);
+            }
+        }
+
+        for (uint32_t pair = 0; pair < pairs; pair++) {
+            LightStatsThread *dst = statsThread(stats, 2 * stride * pair);
+            const LightStatsThread *src = statsThread(stats, 2 * stride * pair + stride);
+            dst->max = max(dst->max, src->max);
+            dst->sum += src->sum;
+            dst->count += src->count;
+        }
+    }
+}
+
+void statsResult(const LightStats *stats, LightLevels *levels) {
+    const LightStatsThread *t = statsThread((LightStats *) stats, 0);
+    levels->pixelCount = t->count;
+    levels->maxCLL = (uint16_t) roundf(t->max * 10000);
+    levels->maxPALL = t->count ? (uint16_t) round(10000 * (t->sum / (double) t->count)) : 0;
+}
+
+double statsPercentile(const LightStats *stats, double percentile) {
+    const LightStatsThread *t = statsThread((LightStats *) stats, 0);
+    if (t->histogram == NULL) {
+        return roundf(t->max * 10000);
+    }
+
+    // Walks down from the bin of the brightest pixel
+    uint32_t bin = (uint32_t) roundf(t->max * t->scale);
+    uint64_t countTarget = (uint64_t) round((1 - percentile) * (double) t->count);
+    uint64_t count = 0;
+    while (1) {
+        count += t->histogram[bin];
+        if (count >= countTarget || bin == 0) {
+            break;
+        }
+        bin--;
+    }
+    return (double) bin / stats->binsPerNit;
+}
@@ -0,0 +1,43 @@
+#ifndef JXR_TO_AVIF_STATS_H
+#define JXR_TO_AVIF_STATS_H
+
+#include <stdint.h>
+
+#include "pool.h"
+
+// Light level statistics of an image: the maximum, sum and a histogram of the brightest component of every
+// pixel, in PQ's linear scale where 1 is 10000 nits. Every thread accumulates into its own cache-aligned copy,
+// and the copies are merged once at the end.
+typedef struct LightStats LightStats;
+typedef struct LightStatsThread LightStatsThread;
+
+typedef struct LightLevels {
+    uint64_t pixelCount;
+    uint16_t maxCLL;  // brightest component of any pixel, as defined by H.274
+    uint16_t maxPALL; // average of the brightest components
+} LightLevels;
+
+// Creates the accumulators for the given number of threads. With binsPerNit > 0, a histogram with that many
+// bins per nit over [0, 10000] nits is kept as well, which statsPercentile() needs. Returns NULL on failure.
+LightStats *statsCreate(uint32_t threads, uint32_t binsPerNit);
+
+void statsDestroy(LightStats *stats);
+
+LightStatsThread *statsThread(LightStats *stats, uint32_t thread);
+
+// Adds n values in [0, 1] to the accumulators of one thread
+void statsAdd(LightStatsThread *t, const float *maxComp, uint32_t n);
+
+// Merges the accumulators of all threads into the first one, pairwise in log2(threads) rounds with the pairs
+// of each round merged in parallel on the pool. Call once after the last statsAdd().
+void statsMerge(LightStats *stats, ThreadPool *pool);
+
+// The following read the merged statistics
+
+void statsResult(const LightStats *stats, LightLevels *levels);
+
+// Returns the light level in nits that is only exceeded by the brightest (1 - percentile) of the pixels,
+// rounded to the histogram's precision, or the maximum if there is no histogram
+double statsPercentile(const LightStats *stats, double percentile);
+
+#endif // JXR_TO_AVIF_STATS_H
@@ -0,0 +1,184 @@
+#include "trace.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "platform.h"
+
+static const char *const stageNames[TRACE_STAGE_COUNT] = {
+        "decode", "convert", "to linear", "PQ", "RGB to YUV", "merge", "encode", "write",
+};
+
+typedef struct TraceEvent {
+    TraceStage stage;
+    uint32_t thread;
+    double start;
+    double end;
+} TraceEvent;
+
+struct Trace {
+    Mutex mutex;
+    double origin; // time of traceCreate(), events are relative to it
+    int recordEvents;
+    TraceEvent *events;
+    size_t eventCount;
+    size_t eventCapacity;
+    double wall[TRACE_STAGE_COUNT];
+    double cpu[TRACE_STAGE_COUNT];
+    double (*threadTimes)[TRACE_STAGE_COUNT]; // indexed by thread id - 1
+    uint32_t threadCount;
+};
+
+// Threads are numbered in the order they first record a span, for all traces alike
+static atomic_uint nextThreadId = 1;
+static _Thread_local uint32_t threadId;
+
+static uint32_t currentThreadId(void) {
+    if (threadId == 0) {
+        threadId = atomic_fetch_add(&nextThreadId, 1);
+    }
+    return threadId;
+}
+
+Trace *traceCreate(int recordEvents) {
+    Trace *trace = calloc(1, sizeof(Trace));
+    if (trace == NULL) {
+        return NULL;
+    }
+    if (mutexInit(&trace->mutex)) {
+        free(trace);
+        return NULL;
+    }
+    trace->origin = platformSeconds();
+    trace->recordEvents = recordEvents;
+    return trace;
+}
+
+void traceDestroy(Trace *trace) {
+    if (trace == NULL) {
+        return;
+    }
+    mutexDestroy(&trace->mutex);
+    free(trace->events);
+    free(trace->threadTimes);
+    free(trace);
+}
+
+void traceSpan(Trace *trace, TraceStage stage, double start, double end) {
+    uint32_t thread = currentThreadId();
+
+    mutexLock(&trace->mutex);
+
+    // Running out of memory only loses the span, the conversion goes on
+    if (thread > trace->threadCount) {
+        void *grown = realloc(trace->threadTimes, sizeof(trace->threadTimes[0]) * thread);
+        if (grown) {
+            trace->threadTimes = grown;
+            for (uint32_t i = trace->threadCount; i < thread; i++) {
+                for (int k = 0; k < TRACE_STAGE_COUNT; k++) {
+                    trace->threadTimes[i][k] = 0;
+                }
+            }
+            trace->threadCount = thread;
+        }
+    }
+    if (thread <= trace->threadCount) {
+        trace->threadTimes[thread - 1][stage] += end - start;
+    }
+
+    if (trace->recordEvents && trace->eventCount == trace->eventCapacity) {
+        size_t newCapacity = trace->eventCapacity ? trace->eventCapacity * 2 : 1024;
+        TraceEvent *grown = realloc(trace->events, sizeof(TraceEvent) * newCapacity);
+        if (grown) {
+            trace->events = grown;
+            trace->eventCapacity = newCapacity;
+        }
+    }
+    if (trace->recordEvents && trace->eventCount < trace->eventCapacity) {
+        TraceEvent *event = &trace->events[trace->eventCount++];
+        event->stage = stage;
+        event->thread = thread;
+        event->start = start - trace->origin;
+        event->end = end - trace->origin;
+    }
+
+    mutexUnlock(&trace->mutex);
+}
+
+void traceAdd(Trace *trace, TraceStage stage, double wall, double cpu) {
+    mutexLock(&trace->mutex);
+    trace->wall[stage] += wall;
+    trace->cpu[stage] += cpu;
+    mutexUnlock(&trace->mutex);
+}
+
+void traceTotals(Trace *trace, TraceStage stage, double *wall, double *cpu) {
+    mutexLock(&trace->mutex);
+    *wall = trace->wall[stage];
+    *cpu = trace->cpu[stage];
+    mutexUnlock(&trace->mutex);
+}
+
+void tracePrintTimings(const Trace *trace, FILE *f) {
+    // The mutex only guards against concurrent changes, by now every stage is done
+    fprintf(f, "%-16s %10s %10s\n", "Stage", "Wall s", "CPU s");
+    for (int k = 0; k < TRACE_STAGE_COUNT; k++) {
+        int subStage = k == TRACE_LINEAR || k == TRACE_PQ || k == TRACE_YUV;
+        fprintf(f, "%s%-*s ", subStage ? "  " : "", subStage ? 14 : 16, stageNames[k]);
+        // Stages that overlap with others have no wall time of their own
+        if (trace->wall[k] > 0) {
+            fprintf(f, "%10.3f", trace->wall[k]);
+        } else {
+            fprintf(f, "%10s", "-");
+        }
+        fprintf(f, " %10.3f\n", trace->cpu[k]);
+    }
+
+    fprintf(f, "Conversion per thread:");
+    for (uint32_t i = 0; i < trace->threadCount; i++) {
+        double busy = trace->threadTimes[i][TRACE_DECODE] + trace->threadTimes[i][TRACE_CONVERT];
+        if (busy > 0) {
+            fprintf(f, " %.3f", busy);
+        }
+    }
+    fprintf(f, "\n");
+}
+
+int traceWrite(const Trace *trace, const char *path) {
+    FILE *f = platformFopen(path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to open trace file\n");
+        return 1;
+    }
+
+    const char *separator = "";
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    for (uint32_t i = 0; i < trace->threadCount; i++) {
+        // Thread ids are shared between traces, skip those of other ones
+        double busy = 0;
+        for (int k = 0; k < TRACE_STAGE_COUNT; k++) {
+            busy += trace->threadTimes[i][k];
+        }
+        if (busy == 0) {
+            continue;
+        }
+        fprintf(f, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, "
+                   "\"args\": {\"name\": \"thread %u\"}}", separator, i + 1, i + 1);
+        separator = ",";
+    }
+    for (size_t i = 0; i < trace->eventCount; i++) {
+        const TraceEvent *event = &trace->events[i];
+        fprintf(f, "%s\n{\"name\": \"%s\", \"cat\": \"pipeline\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, "
+                   "\"ts\": %.1f, \"dur\": %.1f}", separator, stageNames[event->stage], event->thread,
+                event->start * 1e6, (event->end - event->start) * 1e6);
+        separator = ",";
+    }
+    fprintf(f, "\n]}\n");
+
+    if (fclose(f)) {
+        fprintf(stderr, "Failed to write trace file\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef JXR_TO_AVIF_TRACE_H
+#define JXR_TO_AVIF_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Stages of the pipeline that are timed
+typedef enum TraceStage {
+    TRACE_DECODE = 0,
+    TRACE_CONVERT, // everything the conversion threads do except decoding, made up of the next three
+    TRACE_LINEAR,  // scRGB to linear BT.2100 and the light level statistics
+    TRACE_PQ,
+    TRACE_YUV,
+    TRACE_MERGE,   // merging the statistics into MaxCLL/MaxPALL
+    TRACE_ENCODE,
+    TRACE_WRITE,
+    TRACE_STAGE_COUNT
+} TraceStage;
+
+// Collects the wall and CPU time of every stage for --timings and, optionally, the spans of every thread as
+// Chrome trace events for --trace. All functions can be called from any thread at the same time.
+typedef struct Trace Trace;
+
+// Creates an empty trace. With recordEvents set, every span is kept for traceWrite(). Returns NULL on failure.
+Trace *traceCreate(int recordEvents);
+
+void traceDestroy(Trace *trace);
+
+// Records that the calling thread spent [start, end) in a stage, both as returned by platformSeconds(). This only
+// adds to the time of the thread and to the trace events, the totals are added separately with traceAdd().
+void traceSpan(Trace *trace, TraceStage stage, double start, double end);
+
+// Adds to the totals of a stage. The wall time is the time the stage took from start to end, the CPU time is the
+// time threads spent in it. For stages run on several threads one or the other may be unknown and passed as 0.
+void traceAdd(Trace *trace, TraceStage stage, double wall, double cpu);
+
+// Returns the totals of a stage as added by traceAdd(). wall is 0 for stages that only have a CPU time.
+void traceTotals(Trace *trace, TraceStage stage, double *wall, double *cpu);
+
+// Prints the totals of every stage and the conversion time of every thread
+void tracePrintTimings(const Trace *trace, FILE *f);
+
+// Writes the recorded spans in Chrome's trace event format, to be opened in chrome://tracing or Perfetto.
+// Returns 0 on success.
+int traceWrite(const Trace *trace, const char *path);
+
+#endif // JXR_TO_AVIF_TRACE_H
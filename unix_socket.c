@@ -0,0 +1,160 @@
+// winsock2.h has to come before windows.h, so this file keeps away from platform.h
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+#else
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "unix_socket.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SOCKET_CHUNK (1 << 20)  // largest single send or receive, as Windows takes an int
+
+#ifdef _WIN32
+typedef SOCKET SocketHandle;
+#define closeHandle closesocket
+#else
+typedef int SocketHandle;
+#define INVALID_SOCKET (-1)
+#define closeHandle close
+#endif
+
+struct Socket {
+    SocketHandle handle;
+};
+
+static Socket *wrapHandle(SocketHandle handle) {
+    Socket *socket = malloc(sizeof(Socket));
+    if (socket == NULL) {
+        closeHandle(handle);
+        return NULL;
+    }
+    socket->handle = handle;
+    return socket;
+}
+
+Socket *socketListen(const char *path, int backlog) {
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path is too long\n");
+        return NULL;
+    }
+    strcpy(address.sun_path, path);
+
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData)) {
+        fprintf(stderr, "Failed to initialize Winsock\n");
+        return NULL;
+    }
+    // Sockets are files without a type of their own, so whatever is there is taken to be a stale one
+    DeleteFileA(path);
+#else
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+#endif
+
+    SocketHandle handle = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (handle == INVALID_SOCKET) {
+        fprintf(stderr, "Failed to create socket\n");
+        return NULL;
+    }
+    if (bind(handle, (struct sockaddr *) &address, sizeof(address)) || listen(handle, backlog)) {
+        fprintf(stderr, "Failed to listen on %s\n", path);
+        closeHandle(handle);
+        return NULL;
+    }
+    return wrapHandle(handle);
+}
+
+Socket *socketAccept(Socket *server) {
+    while (1) {
+        SocketHandle handle = accept(server->handle, NULL, NULL);
+        if (handle != INVALID_SOCKET) {
+            return wrapHandle(handle);
+        }
+#ifndef _WIN32
+        // Connections that were reset while waiting to be accepted don't stop the server
+        if (errno == EINTR || errno == ECONNABORTED) {
+            continue;
+        }
+#endif
+        return NULL;
+    }
+}
+
+int socketSetTimeout(Socket *socket, uint32_t milliseconds) {
+#ifdef _WIN32
+    DWORD timeout = milliseconds;
+#else
+    struct timeval timeout = {milliseconds / 1000, (milliseconds % 1000) * 1000};
+#endif
+    return setsockopt(socket->handle, SOL_SOCKET, SO_RCVTIMEO, (const char *) &timeout, sizeof(timeout)) ||
+           setsockopt(socket->handle, SOL_SOCKET, SO_SNDTIMEO, (const char *) &timeout, sizeof(timeout));
+}
+
+int socketRead(Socket *socket, void *buffer, size_t size) {
+    char *p = buffer;
+    while (size > 0) {
+        int n = (int) recv(socket->handle, p, (int) (size < SOCKET_CHUNK ? size : SOCKET_CHUNK), 0);
+        if (n <= 0) {
+#ifdef _WIN32
+            if (n < 0 && WSAGetLastError() == WSAETIMEDOUT) {
+                return SOCKET_TIMED_OUT;
+            }
+#else
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return SOCKET_TIMED_OUT;
+            }
+#endif
+            return 1;
+        }
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+int socketWrite(Socket *socket, const void *buffer, size_t size) {
+#ifdef _WIN32
+    int flags = 0;
+#else
+    int flags = MSG_NOSIGNAL; // a client that went away is an error of this request, not a reason to exit
+#endif
+    const char *p = buffer;
+    while (size > 0) {
+        int n = (int) send(socket->handle, p, (int) (size < SOCKET_CHUNK ? size : SOCKET_CHUNK), flags);
+        if (n <= 0) {
+#ifndef _WIN32
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+#endif
+            return 1;
+        }
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+void socketClose(Socket *socket) {
+    if (socket) {
+        closeHandle(socket->handle);
+        free(socket);
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef JXR_TO_AVIF_UNIX_SOCKET_H
+#define JXR_TO_AVIF_UNIX_SOCKET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A listening or connected Unix domain socket, which Windows supports since Windows 10 1803
+typedef struct Socket Socket;
+
+// Listens at path, replacing a socket left there by an earlier process. Returns NULL on failure.
+Socket *socketListen(const char *path, int backlog);
+
+// Waits for the next connection. Returns NULL on failure.
+Socket *socketAccept(Socket *server);
+
+// Limits every single receive and send on the socket to the given time. Returns 0 on success.
+int socketSetTimeout(Socket *socket, uint32_t milliseconds);
+
+#define SOCKET_TIMED_OUT 2
+
+// Reads exactly size bytes. Returns 0 on success, SOCKET_TIMED_OUT if the peer sent nothing for the timeout, and
+// another nonzero value on error or if the peer closed the connection first.
+int socketRead(Socket *socket, void *buffer, size_t size);
+
+// Writes all size bytes. Returns 0 on success.
+int socketWrite(Socket *socket, const void *buffer, size_t size);
+
+void socketClose(Socket *socket);
+
+#endif // JXR_TO_AVIF_UNIX_SOCKET_H
@@ -0,0 +1,254 @@
+#include "verify.h"
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "convert.h"
+#include "platform.h"
+
+#define VERIFY_BAND_HEIGHT 16
+
+// Per-thread state, indexed by pool worker
+typedef struct VerifyThread {
+    PixelSource *source; // this thread's fork of the input
+    uint8_t *band;
+    double maxCodeError;
+    double sumDeltaE;
+    double maxDeltaE;
+    uint64_t visiblePixels;
+} VerifyThread;
+
+typedef struct VerifyJob {
+    PixelSource *source;
+    const uint8_t *pixels; // the whole decoded frame, if the source can't fork
+    const avifImage *image;
+    VerifyThread *threads;
+    atomic_int failed;
+} VerifyJob;
+
+// PQ EOTF, the inverse of pq_inv_eotf()
+static float pqEotf(float e) {
+    const float m1 = 1305 / 8192.f;
+    const float m2 = 2523 / 32.f;
+    const float c1 = 107 / 128.f;
+    const float c2 = 2413 / 128.f;
+    const float c3 = 2392 / 128.f;
+
+    float em2 = powf(min(1, max(e, 0)), 1 / m2);
+    return powf(max(em2 - c1, 0) / (c2 - c3 * em2), 1 / m1);
+}
+
+// ICtCp of linear BT.2100 RGB as defined in BT.2100, with Ct halved as ΔE_ITP needs it
+static void linearToItp(const float rgb[3], float itp[3]) {
+    float l = pq_inv_eotf((1688 * rgb[0] + 2146 * rgb[1] + 262 * rgb[2]) / 4096);
+    float m = pq_inv_eotf((683 * rgb[0] + 2951 * rgb[1] + 462 * rgb[2]) / 4096);
+    float s = pq_inv_eotf((99 * rgb[0] + 309 * rgb[1] + 3688 * rgb[2]) / 4096);
+
+    itp[0] = 0.5f * l + 0.5f * m;
+    itp[1] = 0.5f * (6610 * l - 13613 * m + 7003 * s) / 4096;
+    itp[2] = (17933 * l - 17390 * m - 543 * s) / 4096;
+}
+
+// Reads the PQ R'G'B' of pixel x of a row of the decoded image, undoing the conversion of convertStoreYuv()
+// or convertStoreGbr()
+static void decodedPixel(const avifImage *image, uint32_t x, uint32_t y, float rgb[3]) {
+    const float maxChannel = (float) ((1 << image->depth) - 1);
+    float planes[3];
+    for (int p = 0; p < 3; p++) {
+        planes[p] = ((const uint16_t *) (image->yuvPlanes[p] + (size_t) image->yuvRowBytes[p] * y))[x];
+    }
+
+    if (image->matrixCoefficients == AVIF_MATRIX_COEFFICIENTS_IDENTITY) {
+        rgb[0] = planes[2] / maxChannel;
+        rgb[1] = planes[0] / maxChannel;
+        rgb[2] = planes[1] / maxChannel;
+        return;
+    }
+
+    const float kr = 0.2627f;
+    const float kb = 0.0593f;
+    const float kg = 1 - kr - kb;
+    const float half = (float) (1 << (image->depth - 1));
+
+    float luma = planes[0] / maxChannel;
+    float cb = (planes[1] - half) / maxChannel;
+    float cr = (planes[2] - half) / maxChannel;
+    rgb[0] = luma + 2 * (1 - kr) * cr;
+    rgb[2] = luma + 2 * (1 - kb) * cb;
+    rgb[1] = (luma - kr * rgb[0] - kb * rgb[2]) / kg;
+}
+
+// Pool task, compares rows [begin, end)
+static void verifyRows(void *arg, uint32_t worker, uint32_t begin, uint32_t end) {
+    VerifyJob *job = (VerifyJob *) arg;
+    VerifyThread *t = &job->threads[worker];
+    const avifImage *image = job->image;
+    uint8_t bytesPerColor = job->source->bytesPerColor;
+    uint32_t width = image->width;
+    size_t stride = (size_t) width * bytesPerColor * 4;
+    const float maxChannel = (float) ((1 << image->depth) - 1);
+
+    if (atomic_load(&job->failed)) {
+        return;
+    }
+
+    const uint8_t *pixels;
+    if (job->source->fork) {
+        if (t->source == NULL) {
+            t->source = job->source->fork(job->source);
+            t->band = malloc(stride * VERIFY_BAND_HEIGHT);
+            if (t->source == NULL || t->band == NULL) {
+                fprintf(stderr, "Failed to set up band decoding\n");
+                atomic_store(&job->failed, 1);
+                return;
+            }
+        }
+        if (t->source->copyRows(t->source, begin, end - begin, t->band, stride)) {
+            atomic_store(&job->failed, 1);
+            return;
+        }
+        pixels = t->band;
+    } else {
+        pixels = job->pixels + stride * begin;
+    }
+
+    ConvertBlock block;
+    // Accumulated locally, so threads only write their state once per band
+    double maxCodeError = 0;
+    double sumDeltaE = 0;
+    double maxDeltaE = 0;
+    uint64_t visiblePixels = 0;
+
+    for (uint32_t i = 0; i < end - begin; i++) {
+        for (uint32_t j = 0; j < width; j += CONVERT_BLOCK) {
+            uint32_t n = min(CONVERT_BLOCK, width - j);
+            const uint8_t *src = pixels + stride * i + (size_t) 4 * bytesPerColor * j;
+
+            // The scalar kernel is the reference of the fast ones
+            if (bytesPerColor == 4) {
+                convertToLinearFloatScalar((const float *) src, 0, n, &block);
+            } else {
+                convertToLinearHalfScalar((const _Float16 *) src, 0, n, &block);
+            }
+
+            for (uint32_t k = 0; k < n; k++) {
+                float expected[3] = {block.r[k], block.g[k], block.b[k]};
+                float decoded[3];
+                decodedPixel(image, j + k, begin + i, decoded);
+
+                float decodedLinear[3];
+                for (int c = 0; c < 3; c++) {
+                    float error = fabsf(pq_inv_eotf(expected[c]) - decoded[c]) * maxChannel;
+                    maxCodeError = max(maxCodeError, error);
+                    decodedLinear[c] = pqEotf(decoded[c]);
+                }
+
+                float expectedItp[3], decodedItp[3];
+                linearToItp(expected, expectedItp);
+                linearToItp(decodedLinear, decodedItp);
+                float di = expectedItp[0] - decodedItp[0];
+                float dt = expectedItp[1] - decodedItp[1];
+                float dp = expectedItp[2] - decodedItp[2];
+                double deltaE = 720 * sqrt(di * di + dt * dt + dp * dp);
+
+                sumDeltaE += deltaE;
+                maxDeltaE = max(maxDeltaE, deltaE);
+                visiblePixels += deltaE > 1;
+            }
+        }
+    }
+
+    t->maxCodeError = max(t->maxCodeError, maxCodeError);
+    t->sumDeltaE += sumDeltaE;
+    t->maxDeltaE = max(t->maxDeltaE, maxDeltaE);
+    t->visiblePixels += visiblePixels;
+}
+
+int verifyOutput(const avifRWData *avif, PixelSource *source, ThreadPool *pool, VerifyResult *result) {
+    uint32_t numThreads = poolThreads(pool);
+    int returnCode = 1;
+    uint8_t *pixels = NULL;
+    VerifyJob job;
+    job.threads = NULL;
+
+    avifImage *image = avifImageCreateEmpty();
+    avifDecoder *decoder = avifDecoderCreate();
+    if (image == NULL || decoder == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        goto cleanup;
+    }
+    decoder->maxThreads = (int) numThreads;
+
+    avifResult decodeResult = avifDecoderReadMemory(decoder, image, avif->data, avif->size);
+    if (decodeResult != AVIF_RESULT_OK) {
+        fprintf(stderr, "Failed to decode output: %s\n", avifResultToString(decodeResult));
+        goto cleanup;
+    }
+
+    if (image->width != source->width || image->height != source->height ||
+        image->yuvFormat != AVIF_PIXEL_FORMAT_YUV444 || image->depth <= 8 ||
+        image->yuvRange != AVIF_RANGE_FULL) {
+        fprintf(stderr, "Decoded output is not a full range 4:4:4 image of the input's size\n");
+        goto cleanup;
+    }
+
+    if (!source->fork) {
+        size_t stride = (size_t) source->width * source->bytesPerColor * 4;
+        pixels = malloc(stride * source->height);
+        if (pixels == NULL) {
+            fprintf(stderr, "Failed to allocate float pixels\n");
+            goto cleanup;
+        }
+        if (source->copyRows(source, 0, source->height, pixels, stride)) {
+            goto cleanup;
+        }
+    }
+
+    job.source = source;
+    job.pixels = pixels;
+    job.image = image;
+    job.threads = calloc(numThreads, sizeof(VerifyThread));
+    atomic_init(&job.failed, 0);
+    if (job.threads == NULL) {
+        fprintf(stderr, "Failed to allocate thread data\n");
+        goto cleanup;
+    }
+
+    poolRun(pool, source->height, VERIFY_BAND_HEIGHT, verifyRows, &job);
+
+    if (atomic_load(&job.failed)) {
+        goto cleanup;
+    }
+
+    double sumDeltaE = 0;
+    result->maxCodeError = 0;
+    result->maxDeltaE = 0;
+    result->visiblePixels = 0;
+    for (uint32_t i = 0; i < numThreads; i++) {
+        result->maxCodeError = max(result->maxCodeError, job.threads[i].maxCodeError);
+        result->maxDeltaE = max(result->maxDeltaE, job.threads[i].maxDeltaE);
+        result->visiblePixels += job.threads[i].visiblePixels;
+        sumDeltaE += job.threads[i].sumDeltaE;
+    }
+    result->meanDeltaE = sumDeltaE / ((double) source->width * source->height);
+
+    returnCode = 0;
+    cleanup:
+    if (job.threads) {
+        for (uint32_t i = 0; i < numThreads; i++) {
+            pixelSourceDestroy(job.threads[i].source);
+            free(job.threads[i].band);
+        }
+        free(job.threads);
+    }
+    free(pixels);
+    if (decoder) {
+        avifDecoderDestroy(decoder);
+    }
+    if (image) {
+        avifImageDestroy(image);
+    }
+    return returnCode;
+}
@@ -0,0 +1,23 @@
+#ifndef JXR_TO_AVIF_VERIFY_H
+#define JXR_TO_AVIF_VERIFY_H
+
+#include <stdint.h>
+
+#include "avif.h"
+#include "pixel_source.h"
+#include "pool.h"
+
+// How far a decoded output is from its source, after the source is converted to BT.2100 and clipped to
+// [0, 10000] nits like the conversion does, but at full precision
+typedef struct VerifyResult {
+    double maxCodeError;    // largest difference of a PQ R'G'B' component, in code values of the output's depth
+    double meanDeltaE;      // ΔE_ITP (ITU-R BT.2124) of all pixels
+    double maxDeltaE;
+    uint64_t visiblePixels; // pixels with a ΔE_ITP above 1, roughly a just noticeable difference
+} VerifyResult;
+
+// Decodes the AVIF file in memory with as many threads as the pool has, and compares every pixel with the
+// source on the pool. Returns 0 on success.
+int verifyOutput(const avifRWData *avif, PixelSource *source, ThreadPool *pool, VerifyResult *result);
+
+#endif // JXR_TO_AVIF_VERIFY_H